@@ -1,5 +1,6 @@
-// smart_mouse.cpp - Compile: g++ smart_mouse.cpp -o smart_mouse -lopencv_core -lopencv_imgproc -lopencv_highgui -lopencv_imgcodecs -lX11 -lXtst -ltesseract -std=c++17
+// smart_mouse.cpp - Compile: g++ smart_mouse.cpp -o smart_mouse -lopencv_core -lopencv_imgproc -lopencv_highgui -lopencv_imgcodecs -lX11 -lXtst -lXext -lXfixes -ltesseract -lrt -pthread -std=c++17
 // Windows: Use Windows.h instead of X11, link against appropriate libs
+// Embedded OCR model: add tessdata_blob.S -DSMART_MOUSE_TESSDATA_FILE='"eng.traineddata"' -DSMART_MOUSE_EMBEDDED_TESSDATA_LANG='"eng"'
 
 #include <iostream>
 #include <vector>
@@ -9,14 +10,51 @@
 #include <memory>
 #include <thread>
 #include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+#include <future>
+#include <atomic>
+#include <unordered_map>
+#include <map>
+#include <random>
+#include <sstream>
+#include <filesystem>
+#include <functional>
+
+#ifdef SMART_MOUSE_HAVE_ZSTD
+    #include <zstd.h>
+#endif
+
+#if defined(_MSC_VER)
+    #include <intrin.h>
+#elif defined(__x86_64__) || defined(__i386__)
+    #include <x86intrin.h>
+#endif
 
 #ifdef _WIN32
     #include <windows.h>
     #pragma comment(lib, "user32.lib")
 #else
+    #include <sys/resource.h>
+    #include <sys/mman.h>
+    #include <sys/stat.h>
+    #include <sys/wait.h>
+    #include <unistd.h>
+    #include <fcntl.h>
+    #include <poll.h>
+    #include <signal.h>
+    #include <cerrno>
     #include <X11/Xlib.h>
     #include <X11/Xutil.h>
     #include <X11/extensions/XTest.h>
+    #include <X11/extensions/shape.h>
+    #include <X11/extensions/Xfixes.h>
 #endif
 
 #include <opencv2/opencv.hpp>
@@ -24,431 +62,6982 @@
 #include <leptonica/allheaders.h>
 
 // ============================================================================
-// CROSS-PLATFORM SCREEN CAPTURE & MOUSE CONTROL
+// SHARED UTILITIES
 // ============================================================================
 
-class ScreenController {
-private:
-#ifdef _WIN32
-    HDC hScreen;
-    HDC hDC;
-    HBITMAP hBitmap;
-    int screenWidth, screenHeight;
+// Runtime SIMD dispatch: a baseline x86-64 build still runs the AVX2 kernels
+// on CPUs that have them. Builds with -march=x86-64-v3 (or /arch:AVX2) use
+// them unconditionally; SMART_MOUSE_SIMD=scalar forces the portable path.
+#if defined(__AVX2__)
+    #define SM_SIMD_AVX2 1
+    #define SM_SIMD_DISPATCH 0
+    #define SM_TARGET_AVX2
+#elif defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+    #define SM_SIMD_AVX2 1
+    #define SM_SIMD_DISPATCH 1
+    #define SM_TARGET_AVX2 __attribute__((target("avx2")))
 #else
-    Display* display;
-    Window root;
-    int screenWidth, screenHeight;
+    #define SM_SIMD_AVX2 0
+    #define SM_SIMD_DISPATCH 0
 #endif
 
-public:
-    ScreenController() {
-#ifdef _WIN32
-        hScreen = GetDC(NULL);
-        screenWidth = GetSystemMetrics(SM_CXSCREEN);
-        screenHeight = GetSystemMetrics(SM_CYSCREEN);
+static bool useAvx2() {
+#if SM_SIMD_AVX2
+    static const bool enabled = [] {
+        const char* force = std::getenv("SMART_MOUSE_SIMD");
+        if (force && std::string(force) == "scalar") return false;
+#if SM_SIMD_DISPATCH
+        return __builtin_cpu_supports("avx2") != 0;
 #else
-        display = XOpenDisplay(nullptr);
-        if (!display) throw std::runtime_error("Cannot open display");
-        root = DefaultRootWindow(display);
-        Screen* screen = DefaultScreenOfDisplay(display);
-        screenWidth = screen->width;
-        screenHeight = screen->height;
+        return true;
+#endif
+    }();
+    return enabled;
+#else
+    return false;
 #endif
+}
+
+static const char* simdLevel() { return useAvx2() ? "avx2" : "scalar"; }
+
+// Four 64-bit lanes accumulate 32-byte blocks (a multiply of the key-mixed
+// halves plus the data itself, as in XXH3) and are folded together with the
+// tail at the end. Keys advance with the offset so moved blocks still change
+// the hash. Both kernels produce identical values.
+static const uint64_t kHashLaneKeys[4] = {0x9E3779B97F4A7C15ull, 0xC2B2AE3D27D4EB4Full,
+                                          0x165667B19E3779F9ull, 0xFF51AFD7ED558CCDull};
+
+static uint64_t hashFinish(uint64_t h, const uint64_t* lanes, const uint8_t* data, size_t i, size_t len) {
+    for (int l = 0; l < 4; l++) {
+        h = (h ^ lanes[l]) * 0x9E3779B97F4A7C15ull;
+        h ^= h >> 29;
+    }
+    for (; i + 8 <= len; i += 8) {
+        uint64_t v;
+        std::memcpy(&v, data + i, 8);
+        h = (h ^ (v * 0xC2B2AE3D27D4EB4Full)) * 0x9E3779B97F4A7C15ull;
+        h ^= h >> 29;
+    }
+    uint64_t tail = 0;
+    if (i < len) std::memcpy(&tail, data + i, len - i);
+    h = (h ^ (tail * 0xC2B2AE3D27D4EB4Full)) * 0x9E3779B97F4A7C15ull;
+    return h ^ (h >> 32);
+}
+
+static uint64_t hashBytesScalar(const uint8_t* data, size_t len, uint64_t seed) {
+    uint64_t h = seed ^ (len * 0xFF51AFD7ED558CCDull);
+    uint64_t lanes[4] = {h, h, h, h};
+    size_t i = 0;
+    for (; i + 32 <= len; i += 32) {
+        for (int l = 0; l < 4; l++) {
+            uint64_t v;
+            std::memcpy(&v, data + i + 8 * l, 8);
+            uint64_t x = v ^ (kHashLaneKeys[l] + i);
+            lanes[l] += v + (x & 0xFFFFFFFFull) * (x >> 32);
+        }
+    }
+    return hashFinish(h, lanes, data, i, len);
+}
+
+#if SM_SIMD_AVX2
+SM_TARGET_AVX2 static uint64_t hashBytesAvx2(const uint8_t* data, size_t len, uint64_t seed) {
+    uint64_t h = seed ^ (len * 0xFF51AFD7ED558CCDull);
+    alignas(32) uint64_t lanes[4] = {h, h, h, h};
+    size_t i = 0;
+    if (len >= 32) {
+        __m256i acc = _mm256_load_si256(reinterpret_cast<const __m256i*>(lanes));
+        __m256i key = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(kHashLaneKeys));
+        const __m256i step = _mm256_set1_epi64x(32);
+        for (; i + 32 <= len; i += 32) {
+            __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i));
+            __m256i x = _mm256_xor_si256(v, key);
+            acc = _mm256_add_epi64(acc, _mm256_add_epi64(v, _mm256_mul_epu32(x, _mm256_srli_epi64(x, 32))));
+            key = _mm256_add_epi64(key, step);
+        }
+        _mm256_store_si256(reinterpret_cast<__m256i*>(lanes), acc);
     }
+    return hashFinish(h, lanes, data, i, len);
+}
+#endif
 
-    ~ScreenController() {
+// Fast non-cryptographic hash over a byte range
+static uint64_t hashBytes(const uint8_t* data, size_t len, uint64_t seed = 0x9E3779B97F4A7C15ull) {
+#if SM_SIMD_AVX2
+    if (useAvx2()) return hashBytesAvx2(data, len, seed);
+#endif
+    return hashBytesScalar(data, len, seed);
+}
+
+// CPU time consumed by the whole process (all threads), in seconds
+static double processCpuSeconds() {
 #ifdef _WIN32
-        ReleaseDC(NULL, hScreen);
+    FILETIME creation, exitTime, kernel, user;
+    GetProcessTimes(GetCurrentProcess(), &creation, &exitTime, &kernel, &user);
+    auto toSeconds = [](const FILETIME& ft) {
+        return ((uint64_t(ft.dwHighDateTime) << 32) | ft.dwLowDateTime) * 1e-7;
+    };
+    return toSeconds(kernel) + toSeconds(user);
 #else
-        if (display) XCloseDisplay(display);
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_utime.tv_sec + usage.ru_stime.tv_sec +
+           (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) * 1e-6;
 #endif
+}
+
+// Milliseconds since process start at which startup milestones were first
+// reached; printed by --startup-report to measure time-to-first-click
+class StartupTimeline {
+private:
+    using Clock = std::chrono::steady_clock;
+    Clock::time_point start = Clock::now();
+    std::mutex mutex;
+    std::vector<std::pair<std::string, double>> marks;
+
+public:
+    static StartupTimeline& instance() {
+        static StartupTimeline timeline;
+        return timeline;
     }
 
-    cv::Mat captureScreen() {
-#ifdef _WIN32
-        hDC = CreateCompatibleDC(hScreen);
-        hBitmap = CreateCompatibleBitmap(hScreen, screenWidth, screenHeight);
-        SelectObject(hDC, hBitmap);
-        BitBlt(hDC, 0, 0, screenWidth, screenHeight, hScreen, 0, 0, SRCCOPY);
+    // Records a stage the first time it is reached; later calls are ignored
+    void mark(const std::string& stage) {
+        double ms = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+        std::lock_guard<std::mutex> lock(mutex);
+        for (const auto& m : marks) {
+            if (m.first == stage) return;
+        }
+        marks.emplace_back(stage, ms);
+    }
 
-        BITMAPINFOHEADER bi = {sizeof(BITMAPINFOHEADER), screenWidth, -screenHeight, 1, 32, BI_RGB};
-        cv::Mat mat(screenHeight, screenWidth, CV_8UC4);
-        GetDIBits(hDC, hBitmap, 0, screenHeight, mat.data, (BITMAPINFO*)&bi, DIB_RGB_COLORS);
-        
-        DeleteObject(hBitmap);
-        DeleteDC(hDC);
-        
-        cv::cvtColor(mat, mat, cv::COLOR_BGRA2BGR);
-        return mat;
+    void report(std::ostream& out) {
+        std::lock_guard<std::mutex> lock(mutex);
+        std::sort(marks.begin(), marks.end(),
+                  [](const auto& a, const auto& b) { return a.second < b.second; });
+        out << "Startup timeline:\n";
+        for (const auto& m : marks) out << "  " << m.second << " ms  " << m.first << "\n";
+    }
+};
+
+// Starts the timeline clock during static initialization
+static StartupTimeline& startupTimeline = StartupTimeline::instance();
+
+// Resident set size of this process in bytes (0 where unsupported)
+static size_t currentRssBytes() {
+#ifdef __linux__
+    std::ifstream statm("/proc/self/statm");
+    size_t pages = 0, resident = 0;
+    statm >> pages >> resident;
+    return resident * (size_t)sysconf(_SC_PAGESIZE);
 #else
-        XImage* img = XGetImage(display, root, 0, 0, screenWidth, screenHeight, AllPlanes, ZPixmap);
-        cv::Mat mat(screenHeight, screenWidth, CV_8UC4, img->data);
-        cv::Mat result;
-        cv::cvtColor(mat, result, cv::COLOR_BGRA2BGR);
-        XDestroyImage(img);
-        return result.clone();
+    return 0;
 #endif
+}
+
+static std::vector<std::string> splitTabs(const std::string& line) {
+    std::vector<std::string> fields;
+    std::string field;
+    std::istringstream in(line);
+    while (std::getline(in, field, '\t')) fields.push_back(field);
+    return fields;
+}
+
+// Keeps tabs and newlines of OCR text from breaking TSV lines
+static std::string tsvField(std::string text) {
+    for (char& c : text) {
+        if (c == '\t' || c == '\n' || c == '\r') c = ' ';
     }
+    return text;
+}
 
-    void moveMouse(int x, int y) {
-#ifdef _WIN32
-        SetCursorPos(x, y);
+// High-water mark of the resident set since start or the last resetPeakRss()
+static size_t peakRssBytes() {
+#ifdef __linux__
+    std::ifstream status("/proc/self/status");
+    std::string line;
+    while (std::getline(status, line)) {
+        if (line.rfind("VmHWM:", 0) == 0) return (size_t)std::atol(line.c_str() + 6) * 1024;
+    }
+    return 0;
 #else
-        XWarpPointer(display, None, root, 0, 0, 0, 0, x, y);
-        XFlush(display);
+    return 0;
 #endif
-    }
+}
 
-    void click(int x, int y, bool rightClick = false) {
-        moveMouse(x, y);
-        std::this_thread::sleep_for(std::chrono::milliseconds(100));
-        
-#ifdef _WIN32
-        DWORD downFlag = rightClick ? MOUSEEVENTF_RIGHTDOWN : MOUSEEVENTF_LEFTDOWN;
-        DWORD upFlag = rightClick ? MOUSEEVENTF_RIGHTUP : MOUSEEVENTF_LEFTUP;
-        mouse_event(downFlag, 0, 0, 0, 0);
-        std::this_thread::sleep_for(std::chrono::milliseconds(50));
-        mouse_event(upFlag, 0, 0, 0, 0);
+static void resetPeakRss() {
+#ifdef __linux__
+    std::ofstream("/proc/self/clear_refs") << "5";
+#endif
+}
+
+// ============================================================================
+// INSTRUMENTATION
+// ============================================================================
+
+// Hot-path timers compile to nothing with -DSMART_MOUSE_METRICS=0
+#ifndef SMART_MOUSE_METRICS
+#define SMART_MOUSE_METRICS 1
+#endif
+
+// Cheap timestamp for scoped timers: the TSC on x86, steady_clock elsewhere.
+// Ticks are converted to time only when metrics are exported.
+static inline uint64_t readTicks() {
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64)
+    return __rdtsc();
 #else
-        unsigned int button = rightClick ? Button3 : Button1;
-        XTestFakeButtonEvent(display, button, True, CurrentTime);
-        XFlush(display);
-        std::this_thread::sleep_for(std::chrono::milliseconds(50));
-        XTestFakeButtonEvent(display, button, False, CurrentTime);
-        XFlush(display);
+    return (uint64_t)std::chrono::steady_clock::now().time_since_epoch().count();
 #endif
+}
+
+// Per-stage latency histograms and event counters. Every thread records into
+// its own block with plain relaxed stores (no locked instructions); export
+// sums all blocks. Histograms are log-linear over ticks: 8 sub-buckets per
+// power of two, i.e. about 12% relative resolution across the whole range.
+class Metrics {
+public:
+    static constexpr int kMaxStages = 64;
+    static constexpr int kMaxCounters = 32;
+    static constexpr int kBuckets = 62 * 8;
+
+    static int bucketOf(uint64_t v) {
+        if (v < 8) return (int)v;
+        int e = 63;
+        while (!(v >> e)) e--;
+        return (e - 2) * 8 + (int)((v >> (e - 3)) & 7);
     }
 
-    void doubleClick(int x, int y) {
-        click(x, y);
-        std::this_thread::sleep_for(std::chrono::milliseconds(100));
-        click(x, y);
+    static uint64_t bucketLowerBound(int index) {
+        if (index < 8) return index;
+        int e = index / 8 + 2;
+        return (uint64_t)(8 + index % 8) << (e - 3);
     }
 
-    std::pair<int, int> getScreenSize() {
-        return {screenWidth, screenHeight};
+    // Registers a stage or counter name once per call site; returns its id
+    static int stage(const std::string& name) { return registerName(registry().stageNames, kMaxStages, name); }
+    static int counter(const std::string& name) { return registerName(registry().counterNames, kMaxCounters, name); }
+
+    static void record(int stage, uint64_t ticks) {
+        if (stage < 0) return;
+        ThreadBlock& block = local();
+        Histogram* h = block.stages[stage].load(std::memory_order_relaxed);
+        if (!h) {
+            h = new Histogram();
+            block.stages[stage].store(h, std::memory_order_release);
+        }
+        bump(h->buckets[bucketOf(ticks)], 1);
+        bump(h->count, 1);
+        bump(h->sum, ticks);
+        if (ticks > h->max.load(std::memory_order_relaxed)) h->max.store(ticks, std::memory_order_relaxed);
     }
-};
 
-// ============================================================================
-// UI ELEMENT DETECTION
-// ============================================================================
+    static void add(int counter, uint64_t n) {
+        if (counter >= 0) bump(local().counters[counter], n);
+    }
 
-struct UIElement {
-    cv::Rect bounds;
-    std::string text;
-    std::string type; // "button", "text", "icon", "input"
-    float confidence;
-    cv::Point center() const { return cv::Point(bounds.x + bounds.width/2, bounds.y + bounds.height/2); }
-};
+    static std::string stageName(int stage) {
+        std::lock_guard<std::mutex> lock(registry().mutex);
+        return stage >= 0 && stage < (int)registry().stageNames.size() ? registry().stageNames[stage] : "?";
+    }
 
-class SmartVision {
-private:
-    tesseract::TessBaseAPI* ocr;
-    
-    // Detect button-like regions using edge detection and contours
-    std::vector<cv::Rect> detectButtonRegions(const cv::Mat& img) {
-        cv::Mat gray, edges, dilated;
-        cv::cvtColor(img, gray, cv::COLOR_BGR2GRAY);
-        
-        // Edge detection
-        cv::Canny(gray, edges, 50, 150);
-        cv::dilate(edges, dilated, cv::Mat(), cv::Point(-1,-1), 2);
-        
-        // Find contours
-        std::vector<std::vector<cv::Point>> contours;
-        cv::findContours(dilated, contours, cv::RETR_EXTERNAL, cv::CHAIN_APPROX_SIMPLE);
-        
-        std::vector<cv::Rect> buttons;
-        for (const auto& contour : contours) {
-            cv::Rect rect = cv::boundingRect(contour);
-            // Filter by size and aspect ratio (typical button characteristics)
-            if (rect.width > 40 && rect.width < 400 && 
-                rect.height > 20 && rect.height < 100 &&
-                rect.width > rect.height) {
-                buttons.push_back(rect);
+    // Tick calibration measured over the whole run so far
+    static uint64_t startTicks() { return registry().startTicks; }
+    static double nanosPerTick() {
+        Registry& r = registry();
+        uint64_t ticks = readTicks() - r.startTicks;
+        double nanos = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - r.startTime).count();
+        return ticks ? nanos / ticks : 1.0;
+    }
+
+    // Prometheus text exposition format (for node_exporter's textfile collector)
+    static void writePrometheus(std::ostream& out) {
+        Snapshot snap = snapshot();
+        out << "# TYPE smart_mouse_stage_seconds histogram\n";
+        for (const auto& stage : snap.stages) {
+            uint64_t cumulative = 0;
+            for (int b = 0; b < kBuckets; b++) {
+                if (!stage.buckets[b]) continue;
+                cumulative += stage.buckets[b];
+                double upper = (b + 1 < kBuckets ? bucketLowerBound(b + 1) : stage.max) * snap.nanosPerTick * 1e-9;
+                out << "smart_mouse_stage_seconds_bucket{stage=\"" << stage.name << "\",le=\"" << upper
+                    << "\"} " << cumulative << "\n";
             }
+            out << "smart_mouse_stage_seconds_bucket{stage=\"" << stage.name << "\",le=\"+Inf\"} "
+                << stage.count << "\n";
+            out << "smart_mouse_stage_seconds_sum{stage=\"" << stage.name << "\"} "
+                << stage.sum * snap.nanosPerTick * 1e-9 << "\n";
+            out << "smart_mouse_stage_seconds_count{stage=\"" << stage.name << "\"} " << stage.count << "\n";
+        }
+        out << "# TYPE smart_mouse_events_total counter\n";
+        for (const auto& counter : snap.counters) {
+            out << "smart_mouse_events_total{event=\"" << counter.first << "\"} " << counter.second << "\n";
         }
-        return buttons;
     }
 
-    // Detect text regions and extract text
-    std::vector<UIElement> detectTextRegions(const cv::Mat& img) {
-        std::vector<UIElement> elements;
-        
-        // OCR on full image
-        ocr->SetImage(img.data, img.cols, img.rows, 3, img.step);
-        ocr->Recognize(0);
-        
-        tesseract::ResultIterator* ri = ocr->GetIterator();
-        tesseract::PageIteratorLevel level = tesseract::RIL_WORD;
-        
-        if (ri != 0) {
-            do {
-                const char* word = ri->GetUTF8Text(level);
-                if (word == nullptr) continue;
-                
-                float conf = ri->Confidence(level);
-                int x1, y1, x2, y2;
-                ri->BoundingBox(level, &x1, &y1, &x2, &y2);
-                
-                UIElement elem;
-                elem.bounds = cv::Rect(x1, y1, x2-x1, y2-y1);
-                elem.text = word;
-                elem.confidence = conf;
-                elem.type = "text";
-                
-                elements.push_back(elem);
-                delete[] word;
-            } while (ri->Next(level));
-            delete ri;
+    static void writeJson(std::ostream& out) {
+        Snapshot snap = snapshot();
+        double ms = snap.nanosPerTick * 1e-6;
+        out << "{\"stages\":{";
+        for (size_t i = 0; i < snap.stages.size(); i++) {
+            const auto& stage = snap.stages[i];
+            out << (i ? "," : "") << "\"" << stage.name << "\":{\"count\":" << stage.count
+                << ",\"total_ms\":" << stage.sum * ms
+                << ",\"mean_ms\":" << (stage.count ? stage.sum * ms / stage.count : 0.0)
+                << ",\"p50_ms\":" << stage.percentile(0.50) * ms
+                << ",\"p90_ms\":" << stage.percentile(0.90) * ms
+                << ",\"p99_ms\":" << stage.percentile(0.99) * ms
+                << ",\"max_ms\":" << stage.max * ms << "}";
         }
-        
-        return elements;
+        out << "},\"counters\":{";
+        for (size_t i = 0; i < snap.counters.size(); i++) {
+            out << (i ? "," : "") << "\"" << snap.counters[i].first << "\":" << snap.counters[i].second;
+        }
+        out << "}}\n";
     }
 
-    // Color-based region detection (for buttons/UI elements)
-    std::vector<cv::Rect> detectColorRegions(const cv::Mat& img, cv::Scalar targetColor, int tolerance = 30) {
-        cv::Mat hsv, mask;
-        cv::cvtColor(img, hsv, cv::COLOR_BGR2HSV);
-        
-        cv::Scalar lower(targetColor[0] - tolerance, 100, 100);
-        cv::Scalar upper(targetColor[0] + tolerance, 255, 255);
-        cv::inRange(hsv, lower, upper, mask);
-        
-        std::vector<std::vector<cv::Point>> contours;
-        cv::findContours(mask, contours, cv::RETR_EXTERNAL, cv::CHAIN_APPROX_SIMPLE);
-        
-        std::vector<cv::Rect> regions;
-        for (const auto& contour : contours) {
-            cv::Rect rect = cv::boundingRect(contour);
-            if (rect.width > 20 && rect.height > 20) {
-                regions.push_back(rect);
-            }
+    // Writes JSON for *.json paths, Prometheus text otherwise. Goes through a
+    // temporary file so collectors never read a partial dump.
+    static bool dump(const std::string& path) {
+        std::string tmp = path + ".tmp";
+        {
+            std::ofstream out(tmp);
+            if (!out) return false;
+            bool json = path.size() >= 5 && path.compare(path.size() - 5, 5, ".json") == 0;
+            if (json) writeJson(out);
+            else writePrometheus(out);
         }
-        return regions;
+        return std::rename(tmp.c_str(), path.c_str()) == 0;
     }
 
-public:
-    SmartVision() {
-        ocr = new tesseract::TessBaseAPI();
-        if (ocr->Init(NULL, "eng")) {
-            throw std::runtime_error("Could not initialize tesseract");
+private:
+    struct Histogram {
+        std::atomic<uint64_t> buckets[kBuckets];
+        std::atomic<uint64_t> count, sum, max;
+        Histogram() : count(0), sum(0), max(0) {
+            for (auto& b : buckets) b.store(0, std::memory_order_relaxed);
         }
-    }
+    };
 
-    ~SmartVision() {
-        ocr->End();
-        delete ocr;
-    }
+    struct ThreadBlock {
+        std::atomic<Histogram*> stages[kMaxStages];
+        std::atomic<uint64_t> counters[kMaxCounters];
+        ThreadBlock() {
+            for (auto& s : stages) s.store(nullptr, std::memory_order_relaxed);
+            for (auto& c : counters) c.store(0, std::memory_order_relaxed);
+        }
+        ~ThreadBlock() {
+            for (auto& s : stages) delete s.load();
+        }
+    };
 
-    std::vector<UIElement> analyzeScreen(const cv::Mat& screenshot) {
-        std::vector<UIElement> allElements;
-        
-        // Detect text elements
-        auto textElements = detectTextRegions(screenshot);
-        allElements.insert(allElements.end(), textElements.begin(), textElements.end());
-        
-        // Detect button-like regions
-        auto buttonRects = detectButtonRegions(screenshot);
-        for (const auto& rect : buttonRects) {
-            UIElement elem;
-            elem.bounds = rect;
-            elem.type = "button";
-            elem.confidence = 0.7f;
-            
-            // Try to extract text from button region
-            cv::Mat roi = screenshot(rect);
-            ocr->SetImage(roi.data, roi.cols, roi.rows, 3, roi.step);
-            char* text = ocr->GetUTF8Text();
-            if (text) {
-                elem.text = text;
-                delete[] text;
+    struct Registry {
+        std::mutex mutex;
+        std::vector<std::string> stageNames, counterNames;
+        std::vector<std::unique_ptr<ThreadBlock>> blocks;
+        std::vector<ThreadBlock*> freeBlocks;   // blocks of exited threads, reused
+        uint64_t startTicks = readTicks();
+        std::chrono::steady_clock::time_point startTime = std::chrono::steady_clock::now();
+    };
+
+    // Hands a block to the thread; returns it to the free list on thread exit
+    // so short-lived threads don't grow the registry, while keeping its data
+    struct LocalHandle {
+        ThreadBlock* block = nullptr;
+        ~LocalHandle() {
+            if (!block) return;
+            std::lock_guard<std::mutex> lock(registry().mutex);
+            registry().freeBlocks.push_back(block);
+        }
+    };
+
+    struct StageSnapshot {
+        std::string name;
+        uint64_t count = 0, sum = 0, max = 0;
+        std::vector<uint64_t> buckets = std::vector<uint64_t>(kBuckets, 0);
+
+        uint64_t percentile(double q) const {
+            uint64_t target = (uint64_t)std::ceil(q * count), seen = 0;
+            for (int b = 0; b < kBuckets; b++) {
+                seen += buckets[b];
+                if (seen >= target && buckets[b]) return std::min(bucketLowerBound(b), max);
             }
-            
-            allElements.push_back(elem);
+            return max;
         }
-        
-        return allElements;
+    };
+
+    struct Snapshot {
+        double nanosPerTick;
+        std::vector<StageSnapshot> stages;
+        std::vector<std::pair<std::string, uint64_t>> counters;
+    };
+
+    static Registry& registry() {
+        static Registry* r = new Registry();   // outlives thread_local handles at exit
+        return *r;
     }
 
-    // Fuzzy text matching
-    float textSimilarity(const std::string& a, const std::string& b) {
-        std::string lowerA = a, lowerB = b;
-        std::transform(lowerA.begin(), lowerA.end(), lowerA.begin(), ::tolower);
-        std::transform(lowerB.begin(), lowerB.end(), lowerB.begin(), ::tolower);
-        
-        if (lowerA.find(lowerB) != std::string::npos || lowerB.find(lowerA) != std::string::npos) {
-            return 0.9f;
+    static ThreadBlock& local() {
+        thread_local LocalHandle handle;
+        if (!handle.block) {
+            Registry& r = registry();
+            std::lock_guard<std::mutex> lock(r.mutex);
+            if (!r.freeBlocks.empty()) {
+                handle.block = r.freeBlocks.back();
+                r.freeBlocks.pop_back();
+            } else {
+                r.blocks.push_back(std::make_unique<ThreadBlock>());
+                handle.block = r.blocks.back().get();
+            }
         }
-        
-        // Simple Levenshtein-like scoring
-        int matches = 0;
-        for (char c : lowerA) {
-            if (lowerB.find(c) != std::string::npos) matches++;
+        return *handle.block;
+    }
+
+    // Only the owning thread writes, so a relaxed load/store pair suffices
+    static void bump(std::atomic<uint64_t>& value, uint64_t n) {
+        value.store(value.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+    }
+
+    static int registerName(std::vector<std::string>& names, int limit, const std::string& name) {
+        std::lock_guard<std::mutex> lock(registry().mutex);
+        for (size_t i = 0; i < names.size(); i++) {
+            if (names[i] == name) return (int)i;
         }
-        return (float)matches / std::max(lowerA.length(), lowerB.length());
+        if ((int)names.size() >= limit) return -1;
+        names.push_back(name);
+        return (int)names.size() - 1;
     }
 
-    UIElement* findBestMatch(std::vector<UIElement>& elements, const std::string& query) {
-        UIElement* best = nullptr;
-        float bestScore = 0.0f;
-        
-        for (auto& elem : elements) {
-            float score = textSimilarity(elem.text, query);
-            
-            // Boost score for buttons when looking for clickable elements
-            if (elem.type == "button") score *= 1.2f;
-            
-            // Boost score based on OCR confidence
-            score *= (elem.confidence / 100.0f);
-            
-            if (score > bestScore) {
-                bestScore = score;
-                best = &elem;
+    static Snapshot snapshot() {
+        Registry& r = registry();
+        Snapshot snap;
+        snap.nanosPerTick = nanosPerTick();
+
+        std::lock_guard<std::mutex> lock(r.mutex);
+        for (size_t s = 0; s < r.stageNames.size(); s++) {
+            StageSnapshot stage;
+            stage.name = r.stageNames[s];
+            for (const auto& block : r.blocks) {
+                Histogram* h = block->stages[s].load(std::memory_order_acquire);
+                if (!h) continue;
+                stage.count += h->count.load(std::memory_order_relaxed);
+                stage.sum += h->sum.load(std::memory_order_relaxed);
+                stage.max = std::max(stage.max, h->max.load(std::memory_order_relaxed));
+                for (int b = 0; b < kBuckets; b++) stage.buckets[b] += h->buckets[b].load(std::memory_order_relaxed);
             }
+            if (stage.count) snap.stages.push_back(std::move(stage));
         }
-        
-        return (bestScore > 0.3f) ? best : nullptr;
+        for (size_t c = 0; c < r.counterNames.size(); c++) {
+            uint64_t total = 0;
+            for (const auto& block : r.blocks) total += block->counters[c].load(std::memory_order_relaxed);
+            snap.counters.emplace_back(r.counterNames[c], total);
+        }
+        return snap;
     }
 };
 
-// ============================================================================
-// SMART MOUSE AUTOMATION ENGINE
-// ============================================================================
-
-class SmartMouse {
-private:
-    ScreenController screen;
-    SmartVision vision;
-    cv::Mat lastScreenshot;
-    std::vector<UIElement> lastElements;
-
+// Timeline of scoped stages in Chrome trace JSON (loadable in Perfetto or
+// chrome://tracing). Each thread appends complete events to its own buffer
+// and publishes them with a release store, so recording takes no lock;
+// a full buffer drops events rather than wrapping under a reader.
+class Tracer {
 public:
-    void updateScreen() {
-        lastScreenshot = screen.captureScreen();
-        lastElements = vision.analyzeScreen(lastScreenshot);
-        std::cout << "Detected " << lastElements.size() << " UI elements\n";
-    }
+    static bool enabled() { return state().active.load(std::memory_order_relaxed); }
 
-    void showDetections() {
-        cv::Mat display = lastScreenshot.clone();
-        for (const auto& elem : lastElements) {
-            cv::rectangle(display, elem.bounds, cv::Scalar(0, 255, 0), 2);
-            cv::putText(display, elem.text + " (" + elem.type + ")", 
-                       cv::Point(elem.bounds.x, elem.bounds.y - 5),
-                       cv::FONT_HERSHEY_SIMPLEX, 0.5, cv::Scalar(0, 255, 0), 1);
+    // Starts a new trace, discarding events of any previous one
+    static void start() {
+        State& st = state();
+        {
+            std::lock_guard<std::mutex> lock(st.mutex);
+            st.retired.clear();
         }
-        cv::imshow("Detected Elements", display);
-        cv::waitKey(0);
+        st.epoch.fetch_add(1, std::memory_order_acq_rel);
+        st.active.store(true, std::memory_order_release);
     }
 
-    bool clickOn(const std::string& target, bool rightClick = false) {
-        updateScreen();
+    // Stops tracing and writes everything recorded since start()
+    static bool stop(const std::string& path) {
+        State& st = state();
+        st.active.store(false, std::memory_order_release);
+        uint64_t epoch = st.epoch.load(std::memory_order_acquire);
+        double usPerTick = Metrics::nanosPerTick() / 1000.0;
+        uint64_t origin = Metrics::startTicks();
+
+        std::ofstream out(path);
+        if (!out) return false;
+        out << std::fixed << std::setprecision(3);
+        out << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+        bool first = true;
+        auto writeThread = [&](int tid, const std::string& name, const Event* events, size_t count, size_t dropped) {
+            out << (first ? "" : ",\n") << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":"
+                << tid << ",\"args\":{\"name\":\"" << name << "\"}}";
+            first = false;
+            for (size_t i = 0; i < count; i++) {
+                const Event& e = events[i];
+                out << ",\n{\"name\":\"" << Metrics::stageName(e.stage) << "\",\"cat\":\"smart_mouse\",\"ph\":\"X\",\"ts\":"
+                    << (e.begin - origin) * usPerTick << ",\"dur\":" << (e.end - e.begin) * usPerTick
+                    << ",\"pid\":1,\"tid\":" << tid << "}";
+            }
+            if (dropped) std::cerr << "Trace buffer of thread " << name << " dropped " << dropped << " events\n";
+        };
+        std::lock_guard<std::mutex> lock(st.mutex);
+        for (const auto& buffer : st.buffers) {
+            if (buffer->epoch.load(std::memory_order_acquire) != epoch) continue;
+            size_t count = buffer->published.load(std::memory_order_acquire);
+            size_t dropped = buffer->dropped.load(std::memory_order_relaxed);
+            if (count > 0) writeThread(buffer->tid, buffer->name, buffer->events.data(), count, dropped);
+        }
+        for (const auto& thread : st.retired) {
+            if (thread.epoch == epoch) {
+                writeThread(thread.tid, thread.name, thread.events.data(), thread.events.size(), thread.dropped);
+            }
+        }
+        out << "\n]}\n";
+        return true;
+    }
+
+    static void record(int stage, uint64_t begin, uint64_t end) {
+        Buffer& buffer = local();
+        uint64_t epoch = state().epoch.load(std::memory_order_acquire);
+        if (buffer.epoch.load(std::memory_order_relaxed) != epoch) {
+            // First event of a new trace: only this thread writes here
+            buffer.published.store(0, std::memory_order_relaxed);
+            buffer.dropped.store(0, std::memory_order_relaxed);
+            if (buffer.events.empty()) buffer.events.resize(kCapacity);
+            buffer.epoch.store(epoch, std::memory_order_release);
+        }
+        size_t index = buffer.published.load(std::memory_order_relaxed);
+        if (index >= kCapacity) {
+            buffer.dropped.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+        buffer.events[index] = {stage, begin, end};
+        buffer.published.store(index + 1, std::memory_order_release);
+    }
+
+    // Label shown for the calling thread in the trace viewer
+    static void setThreadName(const std::string& name) {
+        Buffer& buffer = local();
+        std::lock_guard<std::mutex> lock(state().mutex);
+        buffer.name = name;
+    }
+
+private:
+    static constexpr size_t kCapacity = 1 << 16;
+
+    struct Event {
+        int stage;
+        uint64_t begin, end;
+    };
+
+    struct Buffer {
+        std::vector<Event> events;
+        std::atomic<size_t> published{0};
+        std::atomic<uint64_t> epoch{0};
+        std::atomic<size_t> dropped{0};
+        int tid = 0;
+        std::string name;
+    };
+
+    // Events of a thread that exited during the trace, copied out so its
+    // buffer can serve the next thread
+    struct Retired {
+        int tid;
+        std::string name;
+        uint64_t epoch;
+        size_t dropped;
+        std::vector<Event> events;
+    };
+
+    struct State {
+        std::atomic<bool> active{false};
+        std::atomic<uint64_t> epoch{0};
+        std::mutex mutex;
+        std::vector<std::unique_ptr<Buffer>> buffers;
+        std::vector<Buffer*> freeBuffers;   // buffers of exited threads, reused
+        std::vector<Retired> retired;
+        int nextTid = 0;
+    };
+
+    // Hands a buffer to the thread; on thread exit its events are kept for
+    // the running trace and the buffer goes back to the free list, so
+    // short-lived threads don't each cost a full buffer
+    struct LocalHandle {
+        Buffer* buffer = nullptr;
+        ~LocalHandle() {
+            if (!buffer) return;
+            State& st = state();
+            std::lock_guard<std::mutex> lock(st.mutex);
+            size_t count = buffer->published.load(std::memory_order_acquire);
+            uint64_t epoch = buffer->epoch.load(std::memory_order_acquire);
+            if (count > 0 && epoch == st.epoch.load(std::memory_order_acquire)) {
+                st.retired.push_back({buffer->tid, buffer->name, epoch, buffer->dropped.load(std::memory_order_relaxed),
+                                      std::vector<Event>(buffer->events.begin(), buffer->events.begin() + count)});
+            }
+            buffer->published.store(0, std::memory_order_relaxed);
+            buffer->epoch.store(0, std::memory_order_release);
+            buffer->dropped.store(0, std::memory_order_relaxed);
+            st.freeBuffers.push_back(buffer);
+        }
+    };
+
+    static State& state() {
+        static State* s = new State();   // outlives threads still tracing at exit
+        return *s;
+    }
+
+    static Buffer& local() {
+        thread_local LocalHandle handle;
+        if (!handle.buffer) {
+            State& st = state();
+            std::lock_guard<std::mutex> lock(st.mutex);
+            if (st.freeBuffers.empty()) {
+                st.buffers.push_back(std::make_unique<Buffer>());
+                handle.buffer = st.buffers.back().get();
+            } else {
+                handle.buffer = st.freeBuffers.back();
+                st.freeBuffers.pop_back();
+            }
+            handle.buffer->tid = ++st.nextTid;
+            handle.buffer->name = "thread " + std::to_string(handle.buffer->tid);
+        }
+        return *handle.buffer;
+    }
+};
+
+// Records the lifetime of a scope into a stage histogram and, while a trace
+// is running, into the timeline
+class ScopedTimer {
+private:
+    int stage;
+    uint64_t start;
+
+public:
+    explicit ScopedTimer(int stageId) : stage(stageId), start(readTicks()) {}
+    ~ScopedTimer() {
+        uint64_t end = readTicks();
+        Metrics::record(stage, end - start);
+        if (Tracer::enabled()) Tracer::record(stage, start, end);
+    }
+    ScopedTimer(const ScopedTimer&) = delete;
+    ScopedTimer& operator=(const ScopedTimer&) = delete;
+};
+
+#define SM_CONCAT_INNER(a, b) a##b
+#define SM_CONCAT(a, b) SM_CONCAT_INNER(a, b)
+#if SMART_MOUSE_METRICS
+    // Times the rest of the enclosing scope under a stage name
+    #define SM_TIMED_SCOPE(name) \
+        static const int SM_CONCAT(smStage, __LINE__) = Metrics::stage(name); \
+        ScopedTimer SM_CONCAT(smTimer, __LINE__)(SM_CONCAT(smStage, __LINE__))
+    // Adds n to a named event counter
+    #define SM_COUNT(name, n) \
+        do { static const int smCounter = Metrics::counter(name); Metrics::add(smCounter, (n)); } while (0)
+#else
+    #define SM_TIMED_SCOPE(name) do {} while (0)
+    #define SM_COUNT(name, n) do {} while (0)
+#endif
+
+// ============================================================================
+// PIXEL FORMAT CONVERSION
+// ============================================================================
+
+enum class PixelDst { Gray, Bgr, Bgra };
+
+// Layout of captured pixels as reported by the X visual (or the DIB on Windows)
+struct PixelFormatDesc {
+    int bitsPerPixel;
+    bool msbFirst;   // byte order of multi-byte pixels in memory
+    uint32_t redMask, greenMask, blueMask;
+};
+
+// Packed 24/32bpp pixel with the byte offsets of B, G and R
+template <int Bytes, int B, int G, int R>
+struct PackedPixel {
+    static constexpr int bytes = Bytes;
+    static void load(const uint8_t* p, uint8_t& b, uint8_t& g, uint8_t& r) { b = p[B]; g = p[G]; r = p[R]; }
+};
+
+// 16bpp 5-6-5, expanded to 8 bits per channel by bit replication
+template <bool Msb>
+struct Rgb565Pixel {
+    static constexpr int bytes = 2;
+    static void load(const uint8_t* p, uint8_t& b, uint8_t& g, uint8_t& r) {
+        unsigned v = Msb ? (p[0] << 8 | p[1]) : (p[1] << 8 | p[0]);
+        unsigned r5 = v >> 11, g6 = (v >> 5) & 63, b5 = v & 31;
+        r = uint8_t(r5 << 3 | r5 >> 2);
+        g = uint8_t(g6 << 2 | g6 >> 4);
+        b = uint8_t(b5 << 3 | b5 >> 2);
+    }
+};
+
+// cvtColor's BGR2GRAY weights in Q14, so results match the OpenCV path
+static constexpr int kGrayB = 1868, kGrayG = 9617, kGrayR = 4899;
+
+static void storePixel(PixelDst dst, uint8_t* out, uint8_t b, uint8_t g, uint8_t r) {
+    if (dst == PixelDst::Gray) {
+        out[0] = uint8_t((b * kGrayB + g * kGrayG + r * kGrayR + (1 << 13)) >> 14);
+    } else {
+        out[0] = b;
+        out[1] = g;
+        out[2] = r;
+        if (dst == PixelDst::Bgra) out[3] = 255;
+    }
+}
+
+static constexpr int dstChannels(PixelDst dst) { return dst == PixelDst::Gray ? 1 : dst == PixelDst::Bgr ? 3 : 4; }
+
+using ConvertRowFn = void (*)(const uint8_t* src, uint8_t* dst, int width, const PixelFormatDesc& format);
+
+template <class Src, PixelDst Dst>
+static void convertRow(const uint8_t* src, uint8_t* dst, int width, const PixelFormatDesc&) {
+    for (int x = 0; x < width; x++, src += Src::bytes, dst += dstChannels(Dst)) {
+        uint8_t b, g, r;
+        Src::load(src, b, g, r);
+        storePixel(Dst, dst, b, g, r);
+    }
+}
+
+// Any other TrueColor layout, driven by the masks at run time
+template <PixelDst Dst>
+static void convertRowGeneric(const uint8_t* src, uint8_t* dst, int width, const PixelFormatDesc& format) {
+    struct Channel {
+        uint32_t mask = 0, scale = 0;   // scale: 16.16 factor from the channel's range to 0-255
+        int shift = 0;
+        explicit Channel(uint32_t m) : mask(m) {
+            if (!mask) return;
+            while (!((mask >> shift) & 1)) shift++;
+            scale = (255u << 16) / (mask >> shift);
+        }
+        uint8_t operator()(uint32_t pixel) const { return uint8_t((((pixel & mask) >> shift) * scale) >> 16); }
+    };
+    const Channel red(format.redMask), green(format.greenMask), blue(format.blueMask);
+    int bytes = format.bitsPerPixel / 8;
+    for (int x = 0; x < width; x++, src += bytes, dst += dstChannels(Dst)) {
+        uint32_t pixel = 0;
+        for (int i = 0; i < bytes; i++) {
+            pixel |= uint32_t(src[format.msbFirst ? bytes - 1 - i : i]) << (8 * i);
+        }
+        storePixel(Dst, dst, blue(pixel), green(pixel), red(pixel));
+    }
+}
+
+#if SM_SIMD_AVX2
+// BGRX (32bpp little-endian, the usual X11 and DIB layout) kernels. Each
+// finishes the last few pixels with the scalar template.
+SM_TARGET_AVX2 static void bgrxToBgrAvx2(const uint8_t* src, uint8_t* dst, int width, const PixelFormatDesc& f) {
+    const __m256i shuffle = _mm256_setr_epi8(0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1,
+                                             0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1);
+    int x = 0;
+    // The upper store spills 4 bytes into the next two pixels, rewritten later
+    for (; x + 10 <= width; x += 8) {
+        __m256i v = _mm256_shuffle_epi8(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + 4 * x)), shuffle);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + 3 * x), _mm256_castsi256_si128(v));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + 3 * x + 12), _mm256_extracti128_si256(v, 1));
+    }
+    convertRow<PackedPixel<4, 0, 1, 2>, PixelDst::Bgr>(src + 4 * x, dst + 3 * x, width - x, f);
+}
+
+// Gray values of 8 BGRX pixels as 32-bit lanes: pixels 0-3 in the low
+// 128 bits, 4-7 in the high
+SM_TARGET_AVX2 static inline __m256i bgrxLumaAvx2(const uint8_t* src) {
+    const __m256i weights = _mm256_setr_epi16(kGrayB, kGrayG, kGrayR, 0, kGrayB, kGrayG, kGrayR, 0,
+                                              kGrayB, kGrayG, kGrayR, 0, kGrayB, kGrayG, kGrayR, 0);
+    const __m256i zero = _mm256_setzero_si256();
+    __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src));
+    __m256i lo = _mm256_madd_epi16(_mm256_unpacklo_epi8(v, zero), weights);
+    __m256i hi = _mm256_madd_epi16(_mm256_unpackhi_epi8(v, zero), weights);
+    return _mm256_srli_epi32(_mm256_add_epi32(_mm256_hadd_epi32(lo, hi), _mm256_set1_epi32(1 << 13)), 14);
+}
+
+SM_TARGET_AVX2 static void bgrxToGrayAvx2(const uint8_t* src, uint8_t* dst, int width, const PixelFormatDesc& f) {
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i order = _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7);
+    int x = 0;
+    for (; x + 16 <= width; x += 16) {
+        __m256i a = bgrxLumaAvx2(src + 4 * x);
+        __m256i b = bgrxLumaAvx2(src + 4 * x + 32);
+        __m256i bytes = _mm256_packus_epi16(_mm256_packus_epi32(a, b), zero);
+        bytes = _mm256_permutevar8x32_epi32(bytes, order);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + x), _mm256_castsi256_si128(bytes));
+    }
+    convertRow<PackedPixel<4, 0, 1, 2>, PixelDst::Gray>(src + 4 * x, dst + x, width - x, f);
+}
+
+SM_TARGET_AVX2 static void bgrxToBgraAvx2(const uint8_t* src, uint8_t* dst, int width, const PixelFormatDesc& f) {
+    const __m256i alpha = _mm256_set1_epi32(int(0xFF000000u));
+    int x = 0;
+    for (; x + 8 <= width; x += 8) {
+        __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + 4 * x));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + 4 * x), _mm256_or_si256(v, alpha));
+    }
+    convertRow<PackedPixel<4, 0, 1, 2>, PixelDst::Bgra>(src + 4 * x, dst + 4 * x, width - x, f);
+}
+#endif
+
+// Converts captured rows of one source format to one destination format.
+// The row kernel is chosen once, when the capture format becomes known.
+class PixelConverter {
+private:
+    PixelFormatDesc format;
+    PixelDst dst;
+    ConvertRowFn row = nullptr;
+    std::string kernelName;
+
+    // Byte offset of an 8-bit channel inside a packed pixel, or -1
+    static int byteOffset(uint32_t mask, int bytes, bool msbFirst) {
+        for (int i = 0; i < bytes; i++) {
+            if (mask == 0xFFu << (8 * i)) return msbFirst ? bytes - 1 - i : i;
+        }
+        return -1;
+    }
+
+    template <PixelDst Dst>
+    ConvertRowFn select() {
+        const PixelFormatDesc& f = format;
+        int bytes = f.bitsPerPixel / 8;
+        int b = byteOffset(f.blueMask, bytes, f.msbFirst);
+        int g = byteOffset(f.greenMask, bytes, f.msbFirst);
+        int r = byteOffset(f.redMask, bytes, f.msbFirst);
+
+        auto packed = [&](int pb, int pg, int pr) { return b == pb && g == pg && r == pr; };
+        if (f.bitsPerPixel == 32 && packed(0, 1, 2)) {
+            kernelName = "bgrx32";
+#if SM_SIMD_AVX2
+            if (useAvx2()) {
+                kernelName += "/avx2";
+                return Dst == PixelDst::Gray ? bgrxToGrayAvx2 : Dst == PixelDst::Bgr ? bgrxToBgrAvx2 : bgrxToBgraAvx2;
+            }
+#endif
+            return convertRow<PackedPixel<4, 0, 1, 2>, Dst>;
+        }
+        if (f.bitsPerPixel == 32 && packed(3, 2, 1)) { kernelName = "xrgb32"; return convertRow<PackedPixel<4, 3, 2, 1>, Dst>; }
+        if (f.bitsPerPixel == 32 && packed(2, 1, 0)) { kernelName = "rgbx32"; return convertRow<PackedPixel<4, 2, 1, 0>, Dst>; }
+        if (f.bitsPerPixel == 32 && packed(1, 2, 3)) { kernelName = "xbgr32"; return convertRow<PackedPixel<4, 1, 2, 3>, Dst>; }
+        if (f.bitsPerPixel == 24 && packed(0, 1, 2)) { kernelName = "bgr24"; return convertRow<PackedPixel<3, 0, 1, 2>, Dst>; }
+        if (f.bitsPerPixel == 24 && packed(2, 1, 0)) { kernelName = "rgb24"; return convertRow<PackedPixel<3, 2, 1, 0>, Dst>; }
+        if (f.bitsPerPixel == 16 && f.redMask == 0xF800 && f.greenMask == 0x07E0 && f.blueMask == 0x001F) {
+            kernelName = f.msbFirst ? "rgb565be" : "rgb565";
+            return f.msbFirst ? convertRow<Rgb565Pixel<true>, Dst> : convertRow<Rgb565Pixel<false>, Dst>;
+        }
+        kernelName = "generic" + std::to_string(f.bitsPerPixel);
+        return convertRowGeneric<Dst>;
+    }
+
+public:
+    PixelConverter(const PixelFormatDesc& sourceFormat, PixelDst destination) : format(sourceFormat), dst(destination) {
+        if (format.bitsPerPixel % 8 != 0 || format.bitsPerPixel < 16 || format.bitsPerPixel > 32) {
+            throw std::runtime_error("Unsupported capture format: " + std::to_string(format.bitsPerPixel) + " bpp");
+        }
+        row = dst == PixelDst::Gray ? select<PixelDst::Gray>()
+            : dst == PixelDst::Bgr  ? select<PixelDst::Bgr>()
+                                    : select<PixelDst::Bgra>();
+    }
+
+    bool matches(const PixelFormatDesc& f) const {
+        return f.bitsPerPixel == format.bitsPerPixel && f.msbFirst == format.msbFirst && f.redMask == format.redMask &&
+               f.greenMask == format.greenMask && f.blueMask == format.blueMask;
+    }
+
+    const std::string& name() const { return kernelName; }
+
+    // stride is the source row pitch in bytes (XImage bytes_per_line)
+    void convert(const uint8_t* src, size_t stride, int width, int height, cv::Mat& out) const {
+        out.create(height, width, CV_8UC(dstChannels(dst)));
+        for (int y = 0; y < height; y++) row(src + y * stride, out.ptr(y), width, format);
+    }
+};
+
+// ============================================================================
+// CROSS-PLATFORM SCREEN CAPTURE & MOUSE CONTROL
+// ============================================================================
+
+// What the automation drives: a real display or the simulated desktop
+class ScreenBackend {
+public:
+    virtual ~ScreenBackend() = default;
+    virtual cv::Mat captureScreen() = 0;
+    // Pixels of one rectangle only (clipped to the screen), so the cost
+    // follows the area watched rather than the screen size
+    virtual cv::Mat captureRegion(const cv::Rect& region) = 0;
+    virtual void moveMouse(int x, int y) = 0;
+    virtual void click(int x, int y, bool rightClick = false) = 0;
+    virtual void doubleClick(int x, int y) = 0;
+    // Turns the wheel at (x, y); positive clicks scroll down
+    virtual void scroll(int x, int y, int clicks) = 0;
+    // Types text into whatever has keyboard focus; '\n' is Return
+    virtual void typeText(const std::string& text) = 0;
+    virtual std::pair<int, int> getScreenSize() = 0;
+    // Name of the conversion kernel selected for the capture format
+    virtual const std::string& captureKernel() const = 0;
+    // Screen rectangle of the mouse cursor image; empty when unknown or
+    // when the cursor is never part of captured frames
+    virtual cv::Rect cursorBounds() { return cv::Rect(); }
+};
+
+class ScreenController : public ScreenBackend {
+private:
+#ifdef _WIN32
+    HDC hScreen;
+    HDC hDC;
+    HBITMAP hBitmap;
+    int screenWidth, screenHeight;
+#else
+    Display* display;
+    Window root;
+    int screenWidth, screenHeight;
+    bool haveXFixes = false;
+#endif
+    std::unique_ptr<PixelConverter> converter;
+
+    // Delay between injected input events, visible as its own trace stage
+    static void pause(int ms) {
+        SM_TIMED_SCOPE("input.pause");
+        std::this_thread::sleep_for(std::chrono::milliseconds(ms));
+    }
+
+    // Copies one on-screen rectangle into a BGR frame
+    cv::Mat grab(const cv::Rect& r) {
+        SM_COUNT("pixels_captured", (uint64_t)r.area());
+#ifdef _WIN32
+        hDC = CreateCompatibleDC(hScreen);
+        hBitmap = CreateCompatibleBitmap(hScreen, r.width, r.height);
+        SelectObject(hDC, hBitmap);
+        {
+            SM_TIMED_SCOPE("capture.gdi");
+            BitBlt(hDC, 0, 0, r.width, r.height, hScreen, r.x, r.y, SRCCOPY);
+        }
+
+        BITMAPINFOHEADER bi = {sizeof(BITMAPINFOHEADER), r.width, -r.height, 1, 32, BI_RGB};
+        cv::Mat mat(r.height, r.width, CV_8UC4);
+        GetDIBits(hDC, hBitmap, 0, r.height, mat.data, (BITMAPINFO*)&bi, DIB_RGB_COLORS);
+        
+        DeleteObject(hBitmap);
+        DeleteDC(hDC);
+        
+        SM_TIMED_SCOPE("capture.convert");
+        cv::Mat result;
+        converter->convert(mat.data, mat.step, r.width, r.height, result);
+        return result;
+#else
+        XImage* img;
+        {
+            SM_TIMED_SCOPE("capture.x11");
+            img = XGetImage(display, root, r.x, r.y, r.width, r.height, AllPlanes, ZPixmap);
+        }
+        if (!img) throw std::runtime_error("XGetImage failed");
+
+        // The image normally matches the visual; re-select if a server disagrees
+        PixelFormatDesc format{img->bits_per_pixel, img->byte_order == MSBFirst, (uint32_t)img->red_mask,
+                               (uint32_t)img->green_mask, (uint32_t)img->blue_mask};
+        if (!converter->matches(format)) converter.reset(new PixelConverter(format, PixelDst::Bgr));
+
+        cv::Mat result;
+        {
+            SM_TIMED_SCOPE("capture.convert");
+            converter->convert(reinterpret_cast<const uint8_t*>(img->data), img->bytes_per_line,
+                               img->width, img->height, result);
+        }
+        XDestroyImage(img);
+        return result;
+#endif
+    }
+
+public:
+    // displayName selects an X display such as ":1"; empty means $DISPLAY
+    explicit ScreenController(const std::string& displayName = "") {
+#ifdef _WIN32
+        hScreen = GetDC(NULL);
+        screenWidth = GetSystemMetrics(SM_CXSCREEN);
+        screenHeight = GetSystemMetrics(SM_CYSCREEN);
+        // GetDIBits below always asks for top-down 32bpp BGRX
+        converter.reset(new PixelConverter({32, false, 0xFF0000, 0x00FF00, 0x0000FF}, PixelDst::Bgr));
+#else
+        display = XOpenDisplay(displayName.empty() ? nullptr : displayName.c_str());
+        if (!display) throw std::runtime_error("Cannot open display " + displayName);
+        root = DefaultRootWindow(display);
+        Screen* screen = DefaultScreenOfDisplay(display);
+        screenWidth = screen->width;
+        screenHeight = screen->height;
+
+        // Root window pixels use the default visual at the pixmap format's bpp
+        int depth = DefaultDepthOfScreen(screen);
+        int bitsPerPixel = depth;
+        int count = 0;
+        if (XPixmapFormatValues* formats = XListPixmapFormats(display, &count)) {
+            for (int i = 0; i < count; i++) {
+                if (formats[i].depth == depth) bitsPerPixel = formats[i].bits_per_pixel;
+            }
+            XFree(formats);
+        }
+        Visual* visual = DefaultVisualOfScreen(screen);
+        converter.reset(new PixelConverter({bitsPerPixel, ImageByteOrder(display) == MSBFirst, (uint32_t)visual->red_mask,
+                                            (uint32_t)visual->green_mask, (uint32_t)visual->blue_mask},
+                                           PixelDst::Bgr));
+        int eventBase, errorBase;
+        haveXFixes = XFixesQueryExtension(display, &eventBase, &errorBase);
+#endif
+    }
+
+    ~ScreenController() override {
+#ifdef _WIN32
+        ReleaseDC(NULL, hScreen);
+#else
+        if (display) XCloseDisplay(display);
+#endif
+    }
+
+    cv::Mat captureScreen() override {
+        SM_TIMED_SCOPE("capture");
+        return grab(cv::Rect(0, 0, screenWidth, screenHeight));
+    }
+
+    cv::Mat captureRegion(const cv::Rect& region) override {
+        SM_TIMED_SCOPE("capture.region");
+        cv::Rect r = region & cv::Rect(0, 0, screenWidth, screenHeight);
+        return r.empty() ? cv::Mat() : grab(r);
+    }
+
+    void moveMouse(int x, int y) override {
+        SM_TIMED_SCOPE("input.move");
+#ifdef _WIN32
+        SetCursorPos(x, y);
+#else
+        XWarpPointer(display, None, root, 0, 0, 0, 0, x, y);
+        XFlush(display);
+#endif
+    }
+
+    void click(int x, int y, bool rightClick = false) override {
+        SM_TIMED_SCOPE("input.click");
+        SM_COUNT("clicks", 1);
+        moveMouse(x, y);
+        pause(100);
+        
+#ifdef _WIN32
+        DWORD downFlag = rightClick ? MOUSEEVENTF_RIGHTDOWN : MOUSEEVENTF_LEFTDOWN;
+        DWORD upFlag = rightClick ? MOUSEEVENTF_RIGHTUP : MOUSEEVENTF_LEFTUP;
+        mouse_event(downFlag, 0, 0, 0, 0);
+        pause(50);
+        mouse_event(upFlag, 0, 0, 0, 0);
+#else
+        unsigned int button = rightClick ? Button3 : Button1;
+        XTestFakeButtonEvent(display, button, True, CurrentTime);
+        XFlush(display);
+        pause(50);
+        XTestFakeButtonEvent(display, button, False, CurrentTime);
+        XFlush(display);
+#endif
+    }
+
+    void doubleClick(int x, int y) override {
+        click(x, y);
+        pause(100);
+        click(x, y);
+    }
+
+    void scroll(int x, int y, int clicks) override {
+        SM_TIMED_SCOPE("input.scroll");
+        moveMouse(x, y);
+#ifdef _WIN32
+        mouse_event(MOUSEEVENTF_WHEEL, 0, 0, (DWORD)(-clicks * WHEEL_DELTA), 0);
+#else
+        unsigned int button = clicks > 0 ? Button5 : Button4;
+        for (int i = 0; i < std::abs(clicks); i++) {
+            XTestFakeButtonEvent(display, button, True, CurrentTime);
+            XTestFakeButtonEvent(display, button, False, CurrentTime);
+        }
+        XFlush(display);
+#endif
+    }
+
+    // Printable ASCII and newlines; anything without a key is skipped
+    void typeText(const std::string& text) override {
+        SM_TIMED_SCOPE("input.type");
+        SM_COUNT("keys", text.size());
+        for (char c : text) {
+#ifdef _WIN32
+            SHORT key = VkKeyScanA(c == '\n' ? '\r' : c);
+            if (key == -1) continue;
+            bool shift = (key & 0x100) != 0;
+            if (shift) keybd_event(VK_SHIFT, 0, 0, 0);
+            keybd_event(LOBYTE(key), 0, 0, 0);
+            keybd_event(LOBYTE(key), 0, KEYEVENTF_KEYUP, 0);
+            if (shift) keybd_event(VK_SHIFT, 0, KEYEVENTF_KEYUP, 0);
+#else
+            // Latin-1 keysyms equal their character codes
+            KeySym sym = c == '\n' ? XK_Return : (KeySym)(unsigned char)c;
+            KeyCode code = XKeysymToKeycode(display, sym);
+            if (!code) continue;
+            int perKeycode = 0;
+            KeySym* syms = XGetKeyboardMapping(display, code, 1, &perKeycode);
+            bool shift = syms && perKeycode > 0 && syms[0] != sym;
+            if (syms) XFree(syms);
+            KeyCode shiftCode = XKeysymToKeycode(display, XK_Shift_L);
+            if (shift) XTestFakeKeyEvent(display, shiftCode, True, CurrentTime);
+            XTestFakeKeyEvent(display, code, True, CurrentTime);
+            XTestFakeKeyEvent(display, code, False, CurrentTime);
+            if (shift) XTestFakeKeyEvent(display, shiftCode, False, CurrentTime);
+            XFlush(display);
+#endif
+            pause(10);
+        }
+    }
+
+    std::pair<int, int> getScreenSize() override {
+        return {screenWidth, screenHeight};
+    }
+
+    const std::string& captureKernel() const override { return converter->name(); }
+
+    cv::Rect cursorBounds() override {
+#ifdef _WIN32
+        CURSORINFO info = {sizeof(CURSORINFO)};
+        if (!GetCursorInfo(&info) || !(info.flags & CURSOR_SHOWING)) return cv::Rect();
+        int hotX = 0, hotY = 0;
+        ICONINFO icon;
+        if (GetIconInfo(info.hCursor, &icon)) {
+            hotX = icon.xHotspot;
+            hotY = icon.yHotspot;
+            if (icon.hbmMask) DeleteObject(icon.hbmMask);
+            if (icon.hbmColor) DeleteObject(icon.hbmColor);
+        }
+        return cv::Rect(info.ptScreenPos.x - hotX, info.ptScreenPos.y - hotY,
+                        GetSystemMetrics(SM_CXCURSOR), GetSystemMetrics(SM_CYCURSOR));
+#else
+        if (!haveXFixes) return cv::Rect();
+        XFixesCursorImage* cursor = XFixesGetCursorImage(display);
+        if (!cursor) return cv::Rect();
+        cv::Rect bounds(cursor->x - cursor->xhot, cursor->y - cursor->yhot, cursor->width, cursor->height);
+        XFree(cursor);
+        return bounds;
+#endif
+    }
+};
+
+// ============================================================================
+// SIMULATED DESKTOP
+// ============================================================================
+
+// Simulated desktop scripts are TSV, one item per line; widgets belong to the
+// window above them and are placed relative to its content area:
+//   screen  <width> <height>
+//   window  <id> <title> <x> <y> <width> <height> [hidden] [modal]
+//   button  <label> <x> <y> <width> <height> [action;action...]
+//   label   <text> <x> <y>
+//   input   <id> <x> <y> <width>
+//   list    <id> <x> <y> <width> <visible rows> <item|item|...>
+// Button actions: open <window>, close [window], scroll <list> <rows>,
+// remove <list> (drops the selected item), clear <input>.
+struct SimWidget {
+    enum Kind { Button, Label, Input, List } kind;
+    std::string name;                 // label text, or the id of inputs and lists
+    cv::Rect bounds;                  // relative to the window content
+    std::vector<std::string> actions;
+    std::vector<std::string> items;
+    int scroll = 0, selected = -1;
+    std::string value;
+};
+
+struct SimWindow {
+    std::string id, title;
+    cv::Rect bounds;
+    bool visible = true, modal = false;
+    std::vector<SimWidget> widgets;
+};
+
+// Orders window with a scrolling list, a form dialog and a confirmation
+static std::string defaultSimScript() {
+    std::string orders;
+    for (int i = 1; i <= 40; i++) orders += (i > 1 ? "|Order " : "Order ") + std::to_string(1000 + i);
+    return "screen\t1280\t800\n"
+           "window\tmain\tOrders\t40\t40\t760\t620\n"
+           "label\tCustomer orders\t20\t30\n"
+           "button\tNew Order\t20\t50\t130\t32\topen neworder\n"
+           "button\tDelete\t160\t50\t100\t32\topen confirm\n"
+           "button\tSettings\t270\t50\t110\t32\topen settings\n"
+           "list\torders\t20\t100\t400\t12\t" + orders + "\n"
+           "button\tUp\t440\t100\t80\t32\tscroll orders -6\n"
+           "button\tDown\t440\t140\t80\t32\tscroll orders 6\n"
+           "window\tneworder\tNew Order\t300\t160\t440\t260\thidden\tmodal\n"
+           "label\tCustomer\t20\t40\n"
+           "input\tcustomer\t130\t18\t280\n"
+           "label\tAmount\t20\t90\n"
+           "input\tamount\t130\t68\t280\n"
+           "button\tCreate\t130\t140\t110\t32\tclose;open created\n"
+           "button\tCancel\t260\t140\t110\t32\tclose;clear customer;clear amount\n"
+           "window\tcreated\tOrder Created\t360\t240\t340\t170\thidden\tmodal\n"
+           "label\tThe order was saved\t20\t40\n"
+           "button\tClose\t120\t80\t100\t32\tclose\n"
+           "window\tconfirm\tConfirm Delete\t360\t220\t360\t170\thidden\tmodal\n"
+           "label\tDelete the selected order?\t20\t40\n"
+           "button\tOK\t60\t80\t100\t32\tremove orders;close\n"
+           "button\tCancel\t190\t80\t100\t32\tclose\n"
+           "window\tsettings\tSettings\t840\t40\t380\t300\thidden\n"
+           "label\tTheme\t20\t40\n"
+           "button\tLight\t20\t60\t100\t32\n"
+           "button\tDark\t130\t60\t100\t32\n"
+           "button\tClose\t20\t200\t100\t32\tclose\n";
+}
+
+// Renders a scriptable desktop into memory and applies clicks and keys to it,
+// so whole workflows run deterministically without a display or any delays.
+// Frames are rendered only after something changed.
+class SimulatedScreen : public ScreenBackend {
+private:
+    static constexpr int kTitleHeight = 28;
+    static constexpr int kRowHeight = 26;
+
+    cv::Size size{1280, 800};
+    std::vector<SimWindow> windows;   // back to front
+    std::string focusWindow;          // the focused input, if any
+    std::string focusInput;
+    cv::Point cursor{0, 0};
+    cv::Mat frame;
+    bool dirty = true;
+    const std::string kernel = "simulated";
+
+    SimWindow* window(const std::string& id) {
+        for (auto& w : windows) {
+            if (w.id == id) return &w;
+        }
+        return nullptr;
+    }
+
+    SimWidget* widget(const std::string& name, SimWidget::Kind kind) {
+        for (auto& w : windows) {
+            for (auto& widget : w.widgets) {
+                if (widget.kind == kind && widget.name == name) return &widget;
+            }
+        }
+        return nullptr;
+    }
+
+    static cv::Rect contentArea(const SimWindow& w) {
+        return cv::Rect(w.bounds.x, w.bounds.y + kTitleHeight, w.bounds.width, w.bounds.height - kTitleHeight);
+    }
+
+    static cv::Rect screenRect(const SimWindow& w, const SimWidget& widget) {
+        return widget.bounds + contentArea(w).tl();
+    }
+
+    void raise(const std::string& id) {
+        auto it = std::find_if(windows.begin(), windows.end(), [&](const SimWindow& w) { return w.id == id; });
+        if (it == windows.end()) return;
+        SimWindow moved = std::move(*it);
+        windows.erase(it);
+        moved.visible = true;
+        windows.push_back(std::move(moved));
+    }
+
+    void perform(const std::string& action, const std::string& owner) {
+        std::istringstream in(action);
+        std::string verb, target;
+        in >> verb >> target;
+        if (verb == "open") {
+            raise(target);
+        } else if (verb == "close") {
+            if (SimWindow* w = window(target.empty() ? owner : target)) w->visible = false;
+            if (focusWindow == (target.empty() ? owner : target)) focusInput.clear();
+        } else if (verb == "scroll") {
+            int rows = 0;
+            in >> rows;
+            if (SimWidget* list = widget(target, SimWidget::List)) {
+                int visible = list->bounds.height / kRowHeight;
+                list->scroll = std::max(0, std::min(list->scroll + rows, (int)list->items.size() - visible));
+            }
+        } else if (verb == "remove") {
+            SimWidget* list = widget(target, SimWidget::List);
+            if (list && list->selected >= 0 && list->selected < (int)list->items.size()) {
+                list->items.erase(list->items.begin() + list->selected);
+                list->selected = -1;
+            }
+        } else if (verb == "clear") {
+            if (SimWidget* input = widget(target, SimWidget::Input)) input->value.clear();
+        }
+    }
+
+    void drawText(const std::string& text, cv::Point origin, const cv::Scalar& color) {
+        cv::putText(frame, text, origin, cv::FONT_HERSHEY_SIMPLEX, 0.55, color, 1, cv::LINE_AA);
+    }
+
+    void drawCentered(const std::string& text, const cv::Rect& rect, const cv::Scalar& color) {
+        int baseline = 0;
+        cv::Size textSize = cv::getTextSize(text, cv::FONT_HERSHEY_SIMPLEX, 0.55, 1, &baseline);
+        drawText(text, cv::Point(rect.x + (rect.width - textSize.width) / 2, rect.y + (rect.height + textSize.height) / 2),
+                 color);
+    }
+
+    void render() {
+        SM_TIMED_SCOPE("capture.render");
+        // Colors are BGR, the light synthetic theme
+        const cv::Scalar desktop(180, 150, 110), fill(245, 245, 245), title(225, 225, 225), text(30, 30, 30),
+            button(215, 120, 0), border(170, 170, 170), white(255, 255, 255), muted(150, 150, 150),
+            selection(240, 210, 170);
+        frame = cv::Mat(size, CV_8UC3, desktop);   // fresh buffer: earlier frames stay valid
+        for (const auto& w : windows) {
+            if (!w.visible) continue;
+            cv::rectangle(frame, w.bounds, fill, cv::FILLED);
+            cv::rectangle(frame, w.bounds, border, 1);
+            cv::rectangle(frame, cv::Rect(w.bounds.x, w.bounds.y, w.bounds.width, kTitleHeight), title, cv::FILLED);
+            drawText(w.title, cv::Point(w.bounds.x + 10, w.bounds.y + 19), text);
+            for (const auto& widget : w.widgets) {
+                cv::Rect rect = screenRect(w, widget);
+                switch (widget.kind) {
+                    case SimWidget::Button:
+                        cv::rectangle(frame, rect, button, cv::FILLED);
+                        cv::rectangle(frame, rect, border, 1);
+                        drawCentered(widget.name, rect, white);
+                        break;
+                    case SimWidget::Label:
+                        drawText(widget.name, rect.tl(), text);
+                        break;
+                    case SimWidget::Input: {
+                        bool focused = focusWindow == w.id && focusInput == widget.name;
+                        cv::rectangle(frame, rect, white, cv::FILLED);
+                        cv::rectangle(frame, rect, focused ? button : border, focused ? 2 : 1);
+                        drawText(widget.value.empty() ? widget.name : widget.value, cv::Point(rect.x + 8, rect.y + 21),
+                                 widget.value.empty() ? muted : text);
+                        break;
+                    }
+                    case SimWidget::List:
+                        cv::rectangle(frame, rect, white, cv::FILLED);
+                        for (int row = 0; row * kRowHeight < rect.height; row++) {
+                            int item = widget.scroll + row;
+                            if (item >= (int)widget.items.size()) break;
+                            cv::Rect line(rect.x, rect.y + row * kRowHeight, rect.width, kRowHeight);
+                            if (item == widget.selected) cv::rectangle(frame, line, selection, cv::FILLED);
+                            drawText(widget.items[item], cv::Point(line.x + 8, line.y + 18), text);
+                        }
+                        cv::rectangle(frame, rect, border, 1);
+                        break;
+                }
+            }
+        }
+        dirty = false;
+    }
+
+    static const std::string& field(const std::vector<std::string>& f, size_t i, int line) {
+        if (i >= f.size()) throw std::runtime_error("Simulated desktop line " + std::to_string(line) + ": missing field");
+        return f[i];
+    }
+
+    static int number(const std::vector<std::string>& f, size_t i, int line) {
+        return std::atoi(field(f, i, line).c_str());
+    }
+
+    void load(std::istream& in) {
+        std::string line;
+        for (int n = 1; std::getline(in, line); n++) {
+            if (line.empty() || line[0] == '#') continue;
+            auto f = splitTabs(line);
+            const std::string& kind = f[0];
+            if (kind == "screen") {
+                size = cv::Size(number(f, 1, n), number(f, 2, n));
+                continue;
+            }
+            if (kind == "window") {
+                SimWindow w;
+                w.id = field(f, 1, n);
+                w.title = field(f, 2, n);
+                w.bounds = cv::Rect(number(f, 3, n), number(f, 4, n), number(f, 5, n), number(f, 6, n));
+                for (size_t i = 7; i < f.size(); i++) {
+                    if (f[i] == "hidden") w.visible = false;
+                    else if (f[i] == "modal") w.modal = true;
+                }
+                windows.push_back(std::move(w));
+                continue;
+            }
+            if (windows.empty() || f.size() < 2) {
+                throw std::runtime_error("Simulated desktop line " + std::to_string(n) + ": widget outside a window");
+            }
+            SimWidget widget;
+            widget.name = f[1];
+            if (kind == "button") {
+                widget.kind = SimWidget::Button;
+                widget.bounds = cv::Rect(number(f, 2, n), number(f, 3, n), number(f, 4, n), number(f, 5, n));
+                std::istringstream actions(f.size() > 6 ? f[6] : "");
+                for (std::string action; std::getline(actions, action, ';');) {
+                    if (!action.empty()) widget.actions.push_back(action);
+                }
+            } else if (kind == "label") {
+                widget.kind = SimWidget::Label;
+                widget.bounds = cv::Rect(number(f, 2, n), number(f, 3, n), 0, 0);
+            } else if (kind == "input") {
+                widget.kind = SimWidget::Input;
+                widget.bounds = cv::Rect(number(f, 2, n), number(f, 3, n), number(f, 4, n), 32);
+            } else if (kind == "list") {
+                widget.kind = SimWidget::List;
+                widget.bounds = cv::Rect(number(f, 2, n), number(f, 3, n), number(f, 4, n), number(f, 5, n) * kRowHeight);
+                std::istringstream items(f.size() > 6 ? f[6] : "");
+                for (std::string item; std::getline(items, item, '|');) widget.items.push_back(item);
+            } else {
+                throw std::runtime_error("Simulated desktop line " + std::to_string(n) + ": unknown item " + kind);
+            }
+            windows.back().widgets.push_back(std::move(widget));
+        }
+        if (windows.empty()) throw std::runtime_error("Simulated desktop has no windows");
+    }
+
+public:
+    // scriptPath empty: the built-in orders desktop
+    explicit SimulatedScreen(const std::string& scriptPath = "") {
+        if (scriptPath.empty()) {
+            std::istringstream in(defaultSimScript());
+            load(in);
+        } else {
+            std::ifstream in(scriptPath);
+            if (!in) throw std::runtime_error("Cannot read simulated desktop " + scriptPath);
+            load(in);
+        }
+    }
+
+    cv::Mat captureScreen() override {
+        SM_TIMED_SCOPE("capture");
+        SM_COUNT("pixels_captured", (uint64_t)size.area());
+        if (dirty) render();
+        return frame;
+    }
+
+    cv::Mat captureRegion(const cv::Rect& region) override {
+        SM_TIMED_SCOPE("capture.region");
+        if (dirty) render();
+        cv::Rect r = region & cv::Rect(0, 0, size.width, size.height);
+        SM_COUNT("pixels_captured", (uint64_t)r.area());
+        return r.empty() ? cv::Mat() : frame(r);
+    }
+
+    void moveMouse(int x, int y) override {
+        SM_TIMED_SCOPE("input.move");
+        cursor = cv::Point(x, y);
+    }
+
+    // Hits the topmost visible window; while a modal window is on top,
+    // clicks outside it are ignored
+    void click(int x, int y, bool rightClick = false) override {
+        SM_TIMED_SCOPE("input.click");
+        SM_COUNT("clicks", 1);
+        moveMouse(x, y);
+        if (rightClick) return;
+        for (auto it = windows.rbegin(); it != windows.rend(); ++it) {
+            if (!it->visible) continue;
+            if (!it->bounds.contains(cursor)) {
+                if (it->modal) return;
+                continue;
+            }
+            std::string owner = it->id;
+            raise(owner);
+            dirty = true;
+            SimWindow& w = windows.back();
+            focusInput.clear();
+            for (auto& widget : w.widgets) {
+                cv::Rect rect = screenRect(w, widget);
+                if (!rect.contains(cursor)) continue;
+                if (widget.kind == SimWidget::Input) {
+                    focusWindow = owner;
+                    focusInput = widget.name;
+                } else if (widget.kind == SimWidget::List) {
+                    int item = widget.scroll + (cursor.y - rect.y) / kRowHeight;
+                    if (item < (int)widget.items.size()) widget.selected = item;
+                } else if (widget.kind == SimWidget::Button) {
+                    std::vector<std::string> actions = widget.actions;   // actions may reorder windows
+                    for (const auto& action : actions) perform(action, owner);
+                }
+                break;
+            }
+            return;
+        }
+    }
+
+    void doubleClick(int x, int y) override {
+        click(x, y);
+        click(x, y);
+    }
+
+    // Scrolls the list under the pointer by three rows per click
+    void scroll(int x, int y, int clicks) override {
+        SM_TIMED_SCOPE("input.scroll");
+        moveMouse(x, y);
+        for (auto it = windows.rbegin(); it != windows.rend(); ++it) {
+            if (!it->visible) continue;
+            if (!it->bounds.contains(cursor)) {
+                if (it->modal) return;
+                continue;
+            }
+            for (auto& widget : it->widgets) {
+                if (widget.kind == SimWidget::List && screenRect(*it, widget).contains(cursor)) {
+                    perform("scroll " + widget.name + " " + std::to_string(clicks * 3), it->id);
+                    dirty = true;
+                }
+            }
+            return;
+        }
+    }
+
+    // Edits the focused input; '\b' deletes, '\n' is ignored
+    void typeText(const std::string& text) override {
+        SM_TIMED_SCOPE("input.type");
+        SM_COUNT("keys", text.size());
+        SimWidget* input = focusInput.empty() ? nullptr : widget(focusInput, SimWidget::Input);
+        if (!input) return;
+        for (char c : text) {
+            if (c == '\b') {
+                if (!input->value.empty()) input->value.pop_back();
+            } else if (c != '\n') {
+                input->value += c;
+            }
+        }
+        dirty = true;
+    }
+
+    std::pair<int, int> getScreenSize() override { return {size.width, size.height}; }
+
+    const std::string& captureKernel() const override { return kernel; }
+
+    // Current value of an input, or the selected item of a list
+    std::string valueOf(const std::string& name) {
+        if (SimWidget* input = widget(name, SimWidget::Input)) return input->value;
+        SimWidget* list = widget(name, SimWidget::List);
+        if (list && list->selected >= 0 && list->selected < (int)list->items.size()) return list->items[list->selected];
+        return "";
+    }
+
+    bool isOpen(const std::string& id) {
+        SimWindow* w = window(id);
+        return w && w->visible;
+    }
+};
+
+// "sim" or "sim:<script>" selects the simulated desktop; anything else is an
+// X display name (empty: $DISPLAY)
+static std::unique_ptr<ScreenBackend> makeScreenBackend(const std::string& name) {
+    if (name == "sim") return std::make_unique<SimulatedScreen>();
+    if (name.rfind("sim:", 0) == 0) return std::make_unique<SimulatedScreen>(name.substr(4));
+    return std::make_unique<ScreenController>(name);
+}
+
+// ============================================================================
+// UI ELEMENT DETECTION
+// ============================================================================
+
+struct UIElement {
+    cv::Rect bounds;
+    std::string text;
+    std::string type; // "button", "text", "icon", "input", "menu"
+    float confidence;
+    cv::Point center() const { return cv::Point(bounds.x + bounds.width/2, bounds.y + bounds.height/2); }
+};
+
+// Boxes labeled "text (type)" over an image; the chosen element in red
+static void drawDetections(cv::Mat& image, const std::vector<UIElement>& elements, const UIElement* chosen = nullptr) {
+    for (const auto& elem : elements) {
+        cv::rectangle(image, elem.bounds, cv::Scalar(0, 255, 0), 2);
+        cv::putText(image, elem.text + " (" + elem.type + ")",
+                    cv::Point(elem.bounds.x, elem.bounds.y - 5),
+                    cv::FONT_HERSHEY_SIMPLEX, 0.5, cv::Scalar(0, 255, 0), 1);
+    }
+    if (chosen) {
+        cv::rectangle(image, chosen->bounds, cv::Scalar(0, 0, 255), 3);
+        cv::circle(image, chosen->center(), 5, cv::Scalar(0, 0, 255), cv::FILLED);
+    }
+}
+
+// ============================================================================
+// OCR WORKER POOL
+// ============================================================================
+
+enum class OcrMode { Words, Text };
+
+struct OcrResult {
+    std::vector<UIElement> words;   // OcrMode::Words: one element per recognized word
+    std::string text;               // OcrMode::Text: text of the whole image
+};
+
+#ifdef SMART_MOUSE_EMBEDDED_TESSDATA_LANG
+// Model linked into a read-only section by SMART_MOUSE_EMBED_TESSDATA
+extern "C" const char smart_mouse_tessdata[];
+extern "C" const char smart_mouse_tessdata_end[];
+#endif
+
+// Loads each language's traineddata once, memory-mapped read-only, and
+// initializes every engine of that language from the same buffer instead of
+// letting each one find, open and read the file itself. Languages are
+// mapped lazily the first time an engine asks for them.
+class TessModelStore {
+private:
+    struct Model {
+        const char* data = nullptr;
+        size_t size = 0;
+        std::string source;         // "embedded" or the file path
+        bool mapped = false;
+        std::vector<char> buffer;   // Windows: file contents read once
+    };
+
+    std::mutex mutex;
+    std::map<std::string, std::unique_ptr<Model>> models;
+
+    TessModelStore() = default;
+
+    static std::string findTraineddata(const std::string& lang) {
+        std::vector<std::string> dirs;
+        if (const char* prefix = std::getenv("TESSDATA_PREFIX")) {
+            dirs.push_back(prefix);
+            dirs.push_back(std::string(prefix) + "/tessdata");
+        }
+#ifndef _WIN32
+        for (const char* dir : {"/usr/share/tesseract-ocr/5/tessdata", "/usr/share/tesseract-ocr/4.00/tessdata",
+                                "/usr/share/tessdata", "/usr/local/share/tessdata",
+                                "/opt/homebrew/share/tessdata"}) {
+            dirs.push_back(dir);
+        }
+#endif
+        for (const auto& dir : dirs) {
+            std::string path = dir + "/" + lang + ".traineddata";
+            if (std::ifstream(path).good()) return path;
+        }
+        return "";
+    }
+
+    static std::unique_ptr<Model> load(const std::string& lang) {
+        auto model = std::make_unique<Model>();
+#ifdef SMART_MOUSE_EMBEDDED_TESSDATA_LANG
+        // The embedded model needs no file I/O at all
+        if (lang == SMART_MOUSE_EMBEDDED_TESSDATA_LANG) {
+            model->data = smart_mouse_tessdata;
+            model->size = smart_mouse_tessdata_end - smart_mouse_tessdata;
+            model->source = "embedded";
+            return model;
+        }
+#endif
+        std::string path = findTraineddata(lang);
+        if (path.empty()) return nullptr;
+        model->source = path;
+#ifdef _WIN32
+        std::ifstream file(path, std::ios::binary);
+        model->buffer.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+        model->data = model->buffer.data();
+        model->size = model->buffer.size();
+#else
+        int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0) return nullptr;
+        struct stat st;
+        void* p = MAP_FAILED;
+        if (fstat(fd, &st) == 0 && st.st_size > 0) {
+            p = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+        }
+        close(fd);
+        if (p == MAP_FAILED) return nullptr;
+        model->data = static_cast<const char*>(p);
+        model->size = st.st_size;
+        model->mapped = true;
+#endif
+        return model;
+    }
+
+public:
+    static TessModelStore& instance() {
+        static TessModelStore store;
+        return store;
+    }
+
+    ~TessModelStore() {
+#ifndef _WIN32
+        for (auto& entry : models) {
+            if (entry.second && entry.second->mapped) {
+                munmap(const_cast<char*>(entry.second->data), entry.second->size);
+            }
+        }
+#endif
+    }
+
+    // Initializes an engine from the shared model, falling back to
+    // Tesseract's own file lookup for multi-language specs ("eng+deu") or
+    // when no traineddata file can be located
+    bool initEngine(tesseract::TessBaseAPI& api, const std::string& lang) {
+        const Model* model = nullptr;
+        if (lang.find('+') == std::string::npos) {
+            std::lock_guard<std::mutex> lock(mutex);
+            auto it = models.find(lang);
+            if (it == models.end()) {
+                it = models.emplace(lang, load(lang)).first;
+                if (it->second) {
+                    startupTimeline.mark("OCR model " + lang + " from " + it->second->source + " (" +
+                                        std::to_string(it->second->size >> 10) + " KB)");
+                }
+            }
+            model = it->second.get();
+        }
+        if (!model) return api.Init(NULL, lang.c_str()) == 0;
+        return api.Init(model->data, (int)model->size, lang.c_str(), tesseract::OEM_DEFAULT,
+                        nullptr, 0, nullptr, nullptr, false, nullptr) == 0;
+    }
+};
+
+// Tesseract engines owned by one worker thread or process, one per language,
+// each created from the model store the first time a job needs it
+class OcrEngines {
+private:
+    std::string defaultLanguage;
+    std::map<std::string, std::unique_ptr<tesseract::TessBaseAPI>> engines;
+
+public:
+    explicit OcrEngines(const std::string& lang) : defaultLanguage(lang) {}
+
+    ~OcrEngines() {
+        for (auto& entry : engines) {
+            if (entry.second) entry.second->End();
+        }
+    }
+
+    // Returns nullptr if the language cannot be initialized
+    tesseract::TessBaseAPI* get(const std::string& lang = "") {
+        const std::string& name = lang.empty() ? defaultLanguage : lang;
+        auto it = engines.find(name);
+        if (it != engines.end()) return it->second.get();
+
+        auto api = std::make_unique<tesseract::TessBaseAPI>();
+        if (!TessModelStore::instance().initEngine(*api, name)) api.reset();
+        return (engines[name] = std::move(api)).get();
+    }
+};
+
+// Runs one OCR job on an initialized engine
+static OcrResult runTesseract(tesseract::TessBaseAPI& api, const cv::Mat& img, OcrMode mode) {
+    SM_COUNT("ocr_calls", 1);
+    SM_COUNT("ocr_pixels", (uint64_t)img.cols * img.rows);
+    OcrResult result;
+    api.SetImage(img.data, img.cols, img.rows, img.channels(), img.step);
+
+    if (mode == OcrMode::Text) {
+        SM_TIMED_SCOPE("ocr.text");
+        char* text = api.GetUTF8Text();
+        if (text) {
+            result.text = text;
+            delete[] text;
+        }
+        return result;
+    }
+
+    SM_TIMED_SCOPE("ocr.words");
+    api.Recognize(0);
+    tesseract::ResultIterator* ri = api.GetIterator();
+    tesseract::PageIteratorLevel level = tesseract::RIL_WORD;
+
+    if (ri != 0) {
+        do {
+            const char* word = ri->GetUTF8Text(level);
+            if (word == nullptr) continue;
+
+            float conf = ri->Confidence(level);
+            int x1, y1, x2, y2;
+            ri->BoundingBox(level, &x1, &y1, &x2, &y2);
+
+            UIElement elem;
+            elem.bounds = cv::Rect(x1, y1, x2-x1, y2-y1);
+            elem.text = word;
+            elem.confidence = conf;
+            elem.type = "text";
+
+            result.words.push_back(elem);
+            delete[] word;
+        } while (ri->Next(level));
+        delete ri;
+    }
+    return result;
+}
+
+#ifndef _WIN32
+// Wire format between OcrProcess and its worker: the image itself travels
+// through the shared-memory slot, only this header goes down the pipe
+struct OcrRequestHeader {
+    uint32_t mode;
+    char language[32];
+    int32_t width, height, channels;
+    uint64_t step, shmBytes;
+};
+
+static bool writeFull(int fd, const void* data, size_t len) {
+    const char* p = static_cast<const char*>(data);
+    while (len > 0) {
+        ssize_t n = ::write(fd, p, len);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        p += n;
+        len -= n;
+    }
+    return true;
+}
+
+// Reads exactly len bytes; fails on EOF or when the deadline passes
+static bool readFull(int fd, void* data, size_t len,
+                     std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::time_point::max()) {
+    char* p = static_cast<char*>(data);
+    while (len > 0) {
+        if (deadline != std::chrono::steady_clock::time_point::max()) {
+            auto remaining = std::chrono::duration_cast<std::chrono::milliseconds>(
+                deadline - std::chrono::steady_clock::now()).count();
+            if (remaining <= 0) return false;
+            struct pollfd pfd = {fd, POLLIN, 0};
+            int ready = ::poll(&pfd, 1, (int)remaining);
+            if (ready < 0 && errno == EINTR) continue;
+            if (ready <= 0) return false;
+        }
+        ssize_t n = ::read(fd, p, len);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        p += n;
+        len -= n;
+    }
+    return true;
+}
+
+template <typename T>
+static void appendPod(std::string& out, const T& value) {
+    out.append(reinterpret_cast<const char*>(&value), sizeof(T));
+}
+
+template <typename T>
+static bool readPod(const std::string& in, size_t& pos, T& value) {
+    if (pos + sizeof(T) > in.size()) return false;
+    std::memcpy(&value, in.data() + pos, sizeof(T));
+    pos += sizeof(T);
+    return true;
+}
+
+static std::string serializeOcrResult(const OcrResult& result) {
+    std::string out;
+    appendPod(out, (uint32_t)result.text.size());
+    out += result.text;
+    appendPod(out, (uint32_t)result.words.size());
+    for (const auto& word : result.words) {
+        int32_t box[4] = {word.bounds.x, word.bounds.y, word.bounds.width, word.bounds.height};
+        appendPod(out, box);
+        appendPod(out, word.confidence);
+        appendPod(out, (uint32_t)word.text.size());
+        out += word.text;
+    }
+    return out;
+}
+
+static bool deserializeOcrResult(const std::string& in, OcrResult& result) {
+    size_t pos = 0;
+    uint32_t len, count;
+    if (!readPod(in, pos, len) || pos + len > in.size()) return false;
+    result.text.assign(in, pos, len);
+    pos += len;
+    if (!readPod(in, pos, count)) return false;
+    for (uint32_t i = 0; i < count; i++) {
+        int32_t box[4];
+        UIElement word;
+        if (!readPod(in, pos, box) || !readPod(in, pos, word.confidence) ||
+            !readPod(in, pos, len) || pos + len > in.size()) return false;
+        word.bounds = cv::Rect(box[0], box[1], box[2], box[3]);
+        word.text.assign(in, pos, len);
+        word.type = "text";
+        pos += len;
+        result.words.push_back(word);
+    }
+    return true;
+}
+
+// Entry point of a worker process (smart_mouse --ocr-worker <lang>): requests
+// arrive on stdin, the shared image slot is fd 3, results go to stdout
+static int runOcrWorkerProcess(const std::string& language) {
+    OcrEngines engines(language);
+    if (!engines.get()) return 1;
+    char ready = 1;
+    if (!writeFull(1, &ready, 1)) return 1;
+
+    const int shmFd = 3;
+    uint8_t* shm = nullptr;
+    size_t mapped = 0;
+    OcrRequestHeader header;
+    while (readFull(0, &header, sizeof(header))) {
+        if (header.shmBytes != mapped) {
+            if (shm) munmap(shm, mapped);
+            void* p = mmap(nullptr, header.shmBytes, PROT_READ, MAP_SHARED, shmFd, 0);
+            if (p == MAP_FAILED) return 1;
+            shm = static_cast<uint8_t*>(p);
+            mapped = header.shmBytes;
+        }
+        cv::Mat image(header.height, header.width, CV_8UC(header.channels), shm, header.step);
+        header.language[sizeof(header.language) - 1] = 0;
+        tesseract::TessBaseAPI* api = engines.get(header.language);
+        OcrResult result;
+        if (api) result = runTesseract(*api, image, (OcrMode)header.mode);
+        std::string payload = serializeOcrResult(result);
+        uint64_t size = payload.size();
+        if (!writeFull(1, &size, sizeof(size)) || !writeFull(1, payload.data(), payload.size())) break;
+    }
+    return 0;
+}
+
+// Runs Tesseract in a child process so a crash or hang costs a restart
+// instead of the whole run. Regions are written once into a shared-memory
+// slot the child maps directly; results come back over a pipe.
+class OcrProcess {
+private:
+    std::string language;
+    int timeoutMs;
+    pid_t pid = -1;
+    int toChild = -1, fromChild = -1;
+    int shmFd = -1;
+    uint8_t* shm = nullptr;
+    size_t shmBytes = 0;
+    long restartCount = 0;
+
+    static std::string executablePath() {
+#ifdef __linux__
+        return "/proc/self/exe";
+#else
+        return selfPath();
+#endif
+    }
+
+    void ensureShm(size_t bytes) {
+        if (bytes <= shmBytes) return;
+        size_t newBytes = std::max(bytes, shmBytes * 2);
+        if (shm) munmap(shm, shmBytes);
+        shm = nullptr;
+        shmBytes = 0;
+        if (ftruncate(shmFd, (off_t)newBytes) != 0) throw std::runtime_error("Cannot resize OCR shared memory");
+        void* p = mmap(nullptr, newBytes, PROT_READ | PROT_WRITE, MAP_SHARED, shmFd, 0);
+        if (p == MAP_FAILED) throw std::runtime_error("Cannot map OCR shared memory");
+        shm = static_cast<uint8_t*>(p);
+        shmBytes = newBytes;
+    }
+
+    // Held from creating an fd until it is close-on-exec, and across fork,
+    // so no worker started from another pool thread inherits our fds
+    static std::mutex& fdMutex() {
+        static std::mutex mutex;
+        return mutex;
+    }
+
+    void spawn() {
+        std::unique_lock<std::mutex> fdLock(fdMutex());
+        int request[2], response[2];
+#ifdef __linux__
+        if (pipe2(request, O_CLOEXEC) != 0) throw std::runtime_error("Cannot create OCR worker pipe");
+        if (pipe2(response, O_CLOEXEC) != 0) {
+            close(request[0]);
+            close(request[1]);
+            throw std::runtime_error("Cannot create OCR worker pipe");
+        }
+#else
+        if (pipe(request) != 0) throw std::runtime_error("Cannot create OCR worker pipe");
+        if (pipe(response) != 0) {
+            close(request[0]);
+            close(request[1]);
+            throw std::runtime_error("Cannot create OCR worker pipe");
+        }
+        for (int fd : {request[0], request[1], response[0], response[1]}) fcntl(fd, F_SETFD, FD_CLOEXEC);
+#endif
+        std::string path = executablePath();
+        pid = fork();
+        if (pid == 0) {
+            // dup2 clears close-on-exec on the targets only, and does
+            // nothing at all when the shared memory already is fd 3
+            dup2(request[0], 0);
+            dup2(response[1], 1);
+            if (shmFd == 3) fcntl(3, F_SETFD, 0);
+            else dup2(shmFd, 3);
+            execl(path.c_str(), path.c_str(), "--ocr-worker", language.c_str(), (char*)nullptr);
+            _exit(127);
+        }
+        fdLock.unlock();
+        close(request[0]);
+        close(response[1]);
+        toChild = request[1];
+        fromChild = response[0];
+        if (pid < 0) {
+            terminate();
+            throw std::runtime_error("Cannot fork OCR worker");
+        }
+
+        char ready;
+        if (!readFull(fromChild, &ready, 1, std::chrono::steady_clock::now() + std::chrono::seconds(30))) {
+            terminate();
+            throw std::runtime_error("OCR worker process failed to start");
+        }
+    }
+
+    void terminate() {
+        if (pid > 0) {
+            ::kill(pid, SIGKILL);
+            struct rusage usage;
+            if (wait4(pid, nullptr, 0, &usage) == pid) {
+#ifdef __APPLE__
+                workerPeakRss() += (size_t)usage.ru_maxrss;          // bytes
+#else
+                workerPeakRss() += (size_t)usage.ru_maxrss * 1024;   // KB
+#endif
+            }
+        }
+        if (toChild >= 0) close(toChild);
+        if (fromChild >= 0) close(fromChild);
+        pid = -1;
+        toChild = fromChild = -1;
+    }
+
+public:
+    // Path used to re-launch this binary where /proc/self/exe is unavailable
+    static std::string& selfPath() {
+        static std::string path;
+        return path;
+    }
+
+    // Sum of the peak resident sets of every worker that has exited since
+    // this was last reset, which the parent's own peak RSS leaves out
+    static std::atomic<size_t>& workerPeakRss() {
+        static std::atomic<size_t> bytes{0};
+        return bytes;
+    }
+
+    OcrProcess(const std::string& lang, int timeout) : language(lang), timeoutMs(timeout) {
+        // A dead worker must surface as a failed write, not kill us
+        signal(SIGPIPE, SIG_IGN);
+
+        static std::atomic<int> counter{0};
+        std::string name = "/smart_mouse_ocr_" + std::to_string(getpid()) + "_" + std::to_string(counter++);
+        {
+            std::lock_guard<std::mutex> fdLock(fdMutex());
+            shmFd = shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+            if (shmFd < 0) throw std::runtime_error("Cannot create OCR shared memory");
+            fcntl(shmFd, F_SETFD, FD_CLOEXEC);
+        }
+        shm_unlink(name.c_str());
+
+        try {
+            ensureShm(8 << 20);
+            spawn();
+        } catch (...) {
+            if (shm) munmap(shm, shmBytes);
+            close(shmFd);
+            throw;
+        }
+    }
+
+    ~OcrProcess() {
+        terminate();
+        if (shm) munmap(shm, shmBytes);
+        close(shmFd);
+    }
+
+    OcrProcess(const OcrProcess&) = delete;
+    OcrProcess& operator=(const OcrProcess&) = delete;
+
+    // Returns false if the worker crashed or timed out; it is restarted
+    // before returning so the next job gets a fresh process
+    bool recognize(const cv::Mat& image, OcrMode mode, const std::string& lang, OcrResult& result) {
+        SM_TIMED_SCOPE("ocr.process_roundtrip");
+        if (pid <= 0) {
+            try {
+                restartCount++;
+                spawn();
+            } catch (const std::exception&) {
+                return false;
+            }
+        }
+
+        size_t rowBytes = image.cols * image.elemSize();
+        ensureShm(rowBytes * image.rows);
+        for (int y = 0; y < image.rows; y++) {
+            std::memcpy(shm + y * rowBytes, image.ptr(y), rowBytes);
+        }
+
+        OcrRequestHeader header = {(uint32_t)mode, {0}, image.cols, image.rows, image.channels(),
+                                   (uint64_t)rowBytes, (uint64_t)shmBytes};
+        std::strncpy(header.language, lang.c_str(), sizeof(header.language) - 1);
+        auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeoutMs);
+        uint64_t size = 0;
+        std::string payload;
+        bool ok = writeFull(toChild, &header, sizeof(header)) &&
+                  readFull(fromChild, &size, sizeof(size), deadline);
+        if (ok) {
+            payload.resize(size);
+            ok = readFull(fromChild, &payload[0], size, deadline) && deserializeOcrResult(payload, result);
+        }
+        if (!ok) {
+            terminate();
+            return false;
+        }
+        return true;
+    }
+
+    long restarts() const { return restartCount; }
+};
+#endif
+
+struct OcrPoolConfig {
+    int workers = 0;                // 0 picks OcrPool::defaultWorkers()
+    std::string language = "eng";
+    size_t cacheEntries = 4096;     // 0 disables the shared result cache
+    bool isolated = false;          // run Tesseract in restartable child processes
+    int timeoutMs = 10000;          // per-job limit for isolated workers
+    bool blockingInit = false;      // constructor waits for all engines to load
+};
+
+// Fixed set of threads, each owning one Tesseract engine. Jobs are queued per
+// session and served round-robin so a busy session cannot starve the others.
+// Results are cached by image content and shared by every session. In
+// isolated mode each thread drives an OcrProcess instead of a local engine.
+class OcrPool {
+private:
+    struct Job {
+        cv::Mat image;
+        OcrMode mode;
+        std::string language;
+        uint64_t key;
+        std::promise<OcrResult> result;
+    };
+
+    OcrPoolConfig config;
+    std::vector<std::thread> workers;
+    std::vector<std::deque<Job>> queues;
+    std::vector<int> freeSessions;   // queues released by removeSession, reused first
+    size_t nextQueue = 0;
+    size_t queuedJobs = 0;
+    bool stopping = false;
+    int pendingInits = 0;
+    int readyWorkers = 0;
+    std::string initError;
+    std::mutex mutex;
+    std::condition_variable jobReady, initDone;
+
+    std::unordered_map<uint64_t, OcrResult> cache;
+    std::deque<uint64_t> cacheOrder;
+    std::atomic<long> jobsRun{0}, cacheHits{0}, jobFailures{0};
+
+    static uint64_t imageKey(const cv::Mat& img, OcrMode mode, const std::string& lang) {
+        uint64_t h = hashBytes(reinterpret_cast<const uint8_t*>(lang.data()), lang.size(),
+                               ((uint64_t)img.cols << 32) ^ ((uint64_t)img.rows << 8) ^
+                               ((uint64_t)img.channels() << 2) ^ (uint64_t)mode);
+        size_t rowBytes = img.cols * img.elemSize();
+        for (int y = 0; y < img.rows; y++) h = hashBytes(img.ptr(y), rowBytes, h);
+        return h;
+    }
+
+    // Takes the next job, rotating across session queues. Caller holds the lock.
+    bool popJob(Job& job) {
+        for (size_t i = 0; i < queues.size(); i++) {
+            size_t q = (nextQueue + i) % queues.size();
+            if (!queues[q].empty()) {
+                job = std::move(queues[q].front());
+                queues[q].pop_front();
+                queuedJobs--;
+                nextQueue = (q + 1) % queues.size();
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void storeInCache(uint64_t key, const OcrResult& result) {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (config.cacheEntries == 0 || cache.count(key)) return;
+        if (cache.size() >= config.cacheEntries) {
+            cache.erase(cacheOrder.front());
+            cacheOrder.pop_front();
+        }
+        cache.emplace(key, result);
+        cacheOrder.push_back(key);
+    }
+
+    void workerLoop(int index) {
+        Tracer::setThreadName("ocr-worker-" + std::to_string(index));
+        std::unique_ptr<OcrEngines> engines;
+#ifndef _WIN32
+        std::unique_ptr<OcrProcess> process;
+#endif
+        std::string error;
+        if (config.isolated) {
+#ifdef _WIN32
+            error = "Isolated OCR workers are not supported on Windows";
+#else
+            try {
+                process = std::make_unique<OcrProcess>(config.language, config.timeoutMs);
+            } catch (const std::exception& e) {
+                error = e.what();
+            }
+#endif
+        } else {
+            engines = std::make_unique<OcrEngines>(config.language);
+            if (!engines->get()) error = "Could not initialize tesseract";
+        }
+
+        // Warm-up: the first recognition allocates most of the engine's
+        // working memory, so pay for it before any real job arrives
+        if (error.empty()) {
+            cv::Mat blank(32, 96, CV_8UC3, cv::Scalar(255, 255, 255));
+            OcrResult ignored;
+#ifndef _WIN32
+            if (process) process->recognize(blank, OcrMode::Text, "", ignored);
+            else
+#endif
+            runTesseract(*engines->get(), blank, OcrMode::Text);
+        }
+
+        std::vector<Job> orphaned;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (error.empty()) readyWorkers++;
+            else initError = error;
+            pendingInits--;
+            // Nobody will ever serve jobs queued while engines were loading
+            if (pendingInits == 0 && readyWorkers == 0) {
+                for (auto& queue : queues) {
+                    for (auto& job : queue) orphaned.push_back(std::move(job));
+                    queue.clear();
+                }
+                queuedJobs = 0;
+            }
+        }
+        initDone.notify_all();
+        if (error.empty()) startupTimeline.mark("OCR engine ready");
+        for (auto& job : orphaned) {
+            job.result.set_exception(std::make_exception_ptr(std::runtime_error(initError)));
+        }
+        if (!error.empty()) return;
+
+        while (true) {
+            Job job;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                jobReady.wait(lock, [this] { return stopping || queuedJobs > 0; });
+                if (!popJob(job)) break;
+            }
+            try {
+                OcrResult result;
+                bool ok = true;
+#ifndef _WIN32
+                if (process) {
+                    ok = process->recognize(job.image, job.mode, job.language, result);
+                } else
+#endif
+                {
+                    tesseract::TessBaseAPI* api = engines->get(job.language);
+                    if (api) result = runTesseract(*api, job.image, job.mode);
+                    else ok = false;
+                }
+                jobsRun++;
+                // A crashed or hung worker yields an empty result, never cached
+                if (ok) storeInCache(job.key, result);
+                else jobFailures++;
+                job.result.set_value(std::move(result));
+            } catch (...) {
+                job.result.set_exception(std::current_exception());
+            }
+        }
+    }
+
+public:
+    static int defaultWorkers() {
+        int hw = (int)std::thread::hardware_concurrency();
+        return std::max(1, std::min(hw, 4));
+    }
+
+    // Engines load and warm up on the worker threads; jobs submitted in the
+    // meantime queue until one is ready, so callers can capture and detect
+    // in parallel with Tesseract initialization
+    explicit OcrPool(const OcrPoolConfig& cfg = OcrPoolConfig()) : config(cfg), queues(1) {
+        int workerCount = config.workers > 0 ? config.workers : defaultWorkers();
+        pendingInits = workerCount;
+        for (int i = 0; i < workerCount; i++) {
+            workers.emplace_back(&OcrPool::workerLoop, this, i);
+        }
+
+        if (config.blockingInit) {
+            try {
+                waitReady();
+            } catch (...) {
+                shutdown();
+                throw;
+            }
+        }
+    }
+
+    ~OcrPool() { shutdown(); }
+
+    OcrPool(const OcrPool&) = delete;
+    OcrPool& operator=(const OcrPool&) = delete;
+
+    // Blocks until every worker finished loading; throws if none succeeded
+    void waitReady() {
+        std::unique_lock<std::mutex> lock(mutex);
+        initDone.wait(lock, [this] { return pendingInits == 0; });
+        if (readyWorkers == 0) throw std::runtime_error(initError);
+    }
+
+    // Registers a new fairness queue; pass the returned id to submit()
+    int addSession() {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (!freeSessions.empty()) {
+            int session = freeSessions.back();
+            freeSessions.pop_back();
+            return session;
+        }
+        queues.emplace_back();
+        return (int)queues.size() - 1;
+    }
+
+    // Hands a session's queue back for reuse; jobs already queued on it
+    // still run
+    void removeSession(int session) {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (session > 0 && session < (int)queues.size()) freeSessions.push_back(session);
+    }
+
+    // Queues OCR of an image (or ROI, which is referenced, not copied). An
+    // empty language uses the pool's default; others load on first use.
+    std::future<OcrResult> submit(const cv::Mat& image, OcrMode mode, int session = 0,
+                                  const std::string& language = "") {
+        Job job;
+        job.image = image;
+        job.mode = mode;
+        job.language = language;
+        job.key = imageKey(image, mode, language);
+        auto future = job.result.get_future();
+
+        std::unique_lock<std::mutex> lock(mutex);
+        if (pendingInits == 0 && readyWorkers == 0) throw std::runtime_error(initError);
+        auto cached = cache.find(job.key);
+        if (cached != cache.end()) {
+            cacheHits++;
+            SM_COUNT("ocr_cache_hits", 1);
+            job.result.set_value(cached->second);
+            return future;
+        }
+        SM_COUNT("ocr_cache_misses", 1);
+        queues[session].push_back(std::move(job));
+        queuedJobs++;
+        lock.unlock();
+        jobReady.notify_one();
+        return future;
+    }
+
+    void shutdown() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        jobReady.notify_all();
+        for (auto& worker : workers) {
+            if (worker.joinable()) worker.join();
+        }
+        workers.clear();
+    }
+
+    size_t workerCount() const { return workers.size(); }
+    long jobs() const { return jobsRun; }
+    long hits() const { return cacheHits; }
+    long failures() const { return jobFailures; }
+};
+
+// Reports resident memory per engine for one init path. Run once per path
+// in separate processes: freed heap from a previous run would skew the other.
+static void benchmarkOcrMemory(int instances, bool shared, const std::string& lang, std::ostream& out) {
+    const double mb = 1024.0 * 1024.0;
+    std::vector<std::unique_ptr<tesseract::TessBaseAPI>> engines;
+    size_t before = currentRssBytes();
+    for (int i = 0; i < instances; i++) {
+        auto api = std::make_unique<tesseract::TessBaseAPI>();
+        bool ok = shared ? TessModelStore::instance().initEngine(*api, lang)
+                         : api->Init(NULL, lang.c_str()) == 0;
+        if (!ok) throw std::runtime_error("Could not initialize tesseract");
+        engines.push_back(std::move(api));
+    }
+    size_t after = currentRssBytes();
+
+    out << (shared ? "shared mapped model" : "file per engine") << ", " << instances << " engines\n";
+    out << "RSS before " << before / mb << " MB, after " << after / mb << " MB, per instance "
+        << ((double)after - (double)before) / mb / std::max(1, instances) << " MB\n";
+    for (auto& api : engines) api->End();
+}
+
+// Times full-frame OCR of one image with in-process and isolated workers
+// (cache disabled) so a deployment can choose between them
+static void benchmarkOcrIsolation(const cv::Mat& image, int iterations, std::ostream& out) {
+    for (bool isolated : {false, true}) {
+        OcrPoolConfig config;
+        config.workers = 1;
+        config.cacheEntries = 0;
+        config.isolated = isolated;
+
+        auto start = std::chrono::steady_clock::now();
+        OcrPool pool(config);
+        pool.waitReady();
+        double startupMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+        std::vector<double> times;
+        for (int i = 0; i < iterations; i++) {
+            auto t0 = std::chrono::steady_clock::now();
+            pool.submit(image, OcrMode::Words).get();
+            times.push_back(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t0).count());
+        }
+        std::sort(times.begin(), times.end());
+        double mean = 0.0;
+        for (double t : times) mean += t;
+        mean /= std::max<size_t>(1, times.size());
+
+        out << (isolated ? "isolated   " : "in-process ") << "startup " << startupMs << " ms, median "
+            << (times.empty() ? 0.0 : times[times.size() / 2]) << " ms, mean " << mean
+            << " ms per OCR, failures " << pool.failures() << "\n";
+    }
+}
+
+enum class ButtonDetector { Edges, Disabled };
+
+struct VisionConfig {
+    ButtonDetector detector = ButtonDetector::Edges;
+    bool ocrButtonCrops = true;   // false labels buttons from the full-frame words
+};
+
+class SmartVision {
+private:
+    friend struct VisionBenchAccess;
+
+    std::shared_ptr<OcrPool> pool;
+    int session;
+    VisionConfig config;
+    
+    // Detect button-like regions using edge detection and contours
+    std::vector<cv::Rect> detectButtonRegions(const cv::Mat& img) {
+        SM_TIMED_SCOPE("vision.buttons");
+        cv::Mat gray, edges, dilated;
+        {
+            SM_TIMED_SCOPE("vision.gray");
+            cv::cvtColor(img, gray, cv::COLOR_BGR2GRAY);
+        }
+        
+        // Edge detection
+        std::vector<std::vector<cv::Point>> contours;
+        {
+            SM_TIMED_SCOPE("vision.canny_contours");
+            cv::Canny(gray, edges, 50, 150);
+            cv::dilate(edges, dilated, cv::Mat(), cv::Point(-1,-1), 2);
+            
+            // Find contours
+            cv::findContours(dilated, contours, cv::RETR_EXTERNAL, cv::CHAIN_APPROX_SIMPLE);
+        }
+        
+        std::vector<cv::Rect> buttons;
+        for (const auto& contour : contours) {
+            cv::Rect rect = cv::boundingRect(contour);
+            // Filter by size and aspect ratio (typical button characteristics)
+            if (rect.width > 40 && rect.width < 400 && 
+                rect.height > 20 && rect.height < 100 &&
+                rect.width > rect.height) {
+                buttons.push_back(rect);
+            }
+        }
+        return buttons;
+    }
+
+    // Detect text regions and extract text
+    std::vector<UIElement> detectTextRegions(const cv::Mat& img) {
+        return pool->submit(img, OcrMode::Words, session).get().words;
+    }
+
+    // Color-based region detection (for buttons/UI elements)
+    std::vector<cv::Rect> detectColorRegions(const cv::Mat& img, cv::Scalar targetColor, int tolerance = 30) {
+        SM_TIMED_SCOPE("vision.color_regions");
+        cv::Mat hsv, mask;
+        cv::cvtColor(img, hsv, cv::COLOR_BGR2HSV);
+        
+        cv::Scalar lower(targetColor[0] - tolerance, 100, 100);
+        cv::Scalar upper(targetColor[0] + tolerance, 255, 255);
+        cv::inRange(hsv, lower, upper, mask);
+        
+        std::vector<std::vector<cv::Point>> contours;
+        cv::findContours(mask, contours, cv::RETR_EXTERNAL, cv::CHAIN_APPROX_SIMPLE);
+        
+        std::vector<cv::Rect> regions;
+        for (const auto& contour : contours) {
+            cv::Rect rect = cv::boundingRect(contour);
+            if (rect.width > 20 && rect.height > 20) {
+                regions.push_back(rect);
+            }
+        }
+        return regions;
+    }
+
+public:
+    // Uses the given OCR pool (e.g. one shared across sessions) or a private one
+    explicit SmartVision(std::shared_ptr<OcrPool> sharedPool = nullptr, const VisionConfig& visionConfig = VisionConfig())
+        : pool(sharedPool ? sharedPool : std::make_shared<OcrPool>()),
+          session(pool->addSession()), config(visionConfig) {}
+
+    std::shared_ptr<OcrPool> ocrPool() const { return pool; }
+
+    std::vector<UIElement> analyzeScreen(const cv::Mat& screenshot) {
+        SM_TIMED_SCOPE("vision.analyze");
+        // Full-frame OCR runs on the pool while buttons are detected here
+        auto textJob = pool->submit(screenshot, OcrMode::Words, session);
+        
+        // Detect button-like regions and queue OCR of each one
+        std::vector<cv::Rect> buttonRects;
+        if (config.detector == ButtonDetector::Edges) buttonRects = detectButtonRegions(screenshot);
+        std::vector<std::future<OcrResult>> buttonJobs;
+        if (config.ocrButtonCrops) {
+            for (const auto& rect : buttonRects) {
+                buttonJobs.push_back(pool->submit(screenshot(rect), OcrMode::Text, session));
+            }
+        }
+        
+        // Detect text elements
+        std::vector<UIElement> allElements;
+        {
+            SM_TIMED_SCOPE("vision.ocr_wait");
+            allElements = textJob.get().words;
+        }
+        
+        size_t wordCount = allElements.size();
+        for (size_t i = 0; i < buttonRects.size(); i++) {
+            UIElement elem;
+            elem.bounds = buttonRects[i];
+            elem.type = "button";
+            elem.confidence = 0.7f;
+            
+            // Text extracted from the button region, or the words inside it
+            if (config.ocrButtonCrops) {
+                elem.text = buttonJobs[i].get().text;
+            } else {
+                for (size_t w = 0; w < wordCount; w++) {
+                    if (!elem.bounds.contains(allElements[w].center())) continue;
+                    if (!elem.text.empty()) elem.text += " ";
+                    elem.text += allElements[w].text;
+                }
+            }
+            
+            allElements.push_back(elem);
+        }
+        
+        return allElements;
+    }
+
+    // Fuzzy text matching
+    float textSimilarity(const std::string& a, const std::string& b) {
+        std::string lowerA = a, lowerB = b;
+        std::transform(lowerA.begin(), lowerA.end(), lowerA.begin(), ::tolower);
+        std::transform(lowerB.begin(), lowerB.end(), lowerB.begin(), ::tolower);
+        
+        if (lowerA.find(lowerB) != std::string::npos || lowerB.find(lowerA) != std::string::npos) {
+            return 0.9f;
+        }
+        
+        // Simple Levenshtein-like scoring
+        int matches = 0;
+        for (char c : lowerA) {
+            if (lowerB.find(c) != std::string::npos) matches++;
+        }
+        return (float)matches / std::max(lowerA.length(), lowerB.length());
+    }
+
+    UIElement* findBestMatch(std::vector<UIElement>& elements, const std::string& query) {
+        SM_TIMED_SCOPE("match");
+        UIElement* best = nullptr;
+        float bestScore = 0.0f;
+        
+        for (auto& elem : elements) {
+            float score = textSimilarity(elem.text, query);
+            
+            // Boost score for buttons when looking for clickable elements
+            if (elem.type == "button") score *= 1.2f;
+            
+            // Boost score based on OCR confidence
+            score *= (elem.confidence / 100.0f);
+            
+            if (score > bestScore) {
+                bestScore = score;
+                best = &elem;
+            }
+        }
+        
+        return (bestScore > 0.3f) ? best : nullptr;
+    }
+};
+
+// ============================================================================
+// CHANGE DETECTION & CAPTURE GOVERNOR
+// ============================================================================
+
+// Splits frames into a grid of tiles and remembers one hash per tile, so
+// consecutive captures can be compared without keeping old pixels around.
+class ChangeDetector {
+private:
+    int tileSize;
+    cv::Size frameSize;
+    std::vector<uint64_t> tileHashes;
+
+public:
+    explicit ChangeDetector(int tileSize = 32) : tileSize(tileSize) {}
+
+    // Returns the rectangles of tiles that differ from the previous frame.
+    // The first frame (or a resolution change) reports the whole frame.
+    std::vector<cv::Rect> update(const cv::Mat& frame) {
+        SM_TIMED_SCOPE("change_detect");
+        int cols = (frame.cols + tileSize - 1) / tileSize;
+        int rows = (frame.rows + tileSize - 1) / tileSize;
+        bool reset = frame.size() != frameSize;
+        if (reset) {
+            frameSize = frame.size();
+            tileHashes.assign(size_t(cols) * rows, 0);
+        }
+
+        std::vector<cv::Rect> changed;
+        size_t rowBytes = frame.elemSize();
+        for (int ty = 0; ty < rows; ty++) {
+            for (int tx = 0; tx < cols; tx++) {
+                cv::Rect tile(tx * tileSize, ty * tileSize, tileSize, tileSize);
+                tile &= cv::Rect(0, 0, frame.cols, frame.rows);
+
+                uint64_t h = 0;
+                for (int y = tile.y; y < tile.y + tile.height; y++) {
+                    h = hashBytes(frame.ptr(y) + tile.x * rowBytes, tile.width * rowBytes, h + y);
+                }
+
+                uint64_t& stored = tileHashes[size_t(ty) * cols + tx];
+                if (reset || stored != h) changed.push_back(tile);
+                stored = h;
+            }
+        }
+        return changed;
+    }
+
+    void reset() { frameSize = cv::Size(); tileHashes.clear(); }
+};
+
+// One hash per pixel row of an image (or ROI)
+static std::vector<uint64_t> rowHashes(const cv::Mat& image) {
+    std::vector<uint64_t> hashes(image.rows);
+    size_t bytes = image.cols * image.elemSize();
+    for (int y = 0; y < image.rows; y++) hashes[y] = hashBytes(image.ptr(y), bytes);
+    return hashes;
+}
+
+// How far the content of a panel moved between two frames, from their row
+// hashes: shift > 0 when rows moved up (scrolled down). Rows that did not
+// change and rows whose hash repeats (blank lines) do not vote. False
+// unless some non-zero shift is backed by at least minRows rows.
+static bool estimateRowShift(const std::vector<uint64_t>& prev, const std::vector<uint64_t>& cur, int minRows,
+                             int& shift) {
+    std::unordered_map<uint64_t, int> rowOf;   // -1 once a hash repeats
+    for (int y = 0; y < (int)prev.size(); y++) {
+        auto inserted = rowOf.emplace(prev[y], y);
+        if (!inserted.second) inserted.first->second = -1;
+    }
+    std::unordered_map<int, int> votes;
+    for (int y = 0; y < (int)cur.size(); y++) {
+        if (y < (int)prev.size() && cur[y] == prev[y]) continue;
+        auto it = rowOf.find(cur[y]);
+        if (it != rowOf.end() && it->second >= 0) votes[it->second - y]++;
+    }
+    int bestVotes = 0;
+    shift = 0;
+    for (const auto& vote : votes) {
+        if (vote.second > bestVotes || (vote.second == bestVotes && std::abs(vote.first) < std::abs(shift))) {
+            shift = vote.first;
+            bestVotes = vote.second;
+        }
+    }
+    return shift != 0 && bestVotes >= minRows;
+}
+
+// One hash per pixel column of an image (or ROI), accumulated row by row so
+// the image is read in memory order
+static std::vector<uint64_t> columnHashes(const cv::Mat& image) {
+    std::vector<uint64_t> hashes(image.cols, 0x9E3779B97F4A7C15ull);
+    size_t pixelBytes = std::min<size_t>(image.elemSize(), sizeof(uint64_t));
+    for (int y = 0; y < image.rows; y++) {
+        const uint8_t* row = image.ptr(y);
+        for (int x = 0; x < image.cols; x++) {
+            uint64_t pixel = 0;
+            std::memcpy(&pixel, row + x * image.elemSize(), pixelBytes);
+            uint64_t h = (hashes[x] ^ pixel) * 0xC2B2AE3D27D4EB4Full;
+            hashes[x] = h ^ (h >> 29);
+        }
+    }
+    return hashes;
+}
+
+// Where a line shift applies within a crop, in lines of the current one
+struct ShiftSpan {
+    int first = 0, last = 0;         // the panel, [first, last), exposed band included
+    int bandFirst = 0, bandLast = 0; // the newly exposed band, [bandFirst, bandLast)
+    std::vector<int> unexplained;    // other lines that neither moved with the panel nor stayed put
+};
+
+// Whether prev shifted by `shift` explains cur. The lines that match under
+// the shift give the panel's extent, which need not be the whole crop
+// (changed tiles overhang it); nearly all lines within it must match, a
+// redraw or a dialog on top leaves many unexplained. Lines that still
+// differ (inside the panel off the shift, outside it from prev) are listed
+// so the caller can analyze them again.
+static bool shiftExplains(const std::vector<uint64_t>& prev, const std::vector<uint64_t>& cur, int shift,
+                          ShiftSpan& span) {
+    span = ShiftSpan();
+    int n = (int)cur.size();
+    if (prev.size() != cur.size() || shift == 0 || std::abs(shift) >= n) return false;
+    int lo = std::max(0, -shift), hi = std::min(n, n - shift);
+    int firstMatch = -1, lastMatch = -1, matched = 0;
+    for (int y = lo; y < hi; y++) {
+        if (cur[y] != prev[y + shift]) continue;
+        if (firstMatch < 0) firstMatch = y;
+        lastMatch = y;
+        matched++;
+    }
+    if (firstMatch < 0 || matched * 10 < (lastMatch - firstMatch + 1) * 9) return false;
+
+    if (shift > 0) {
+        span.first = firstMatch;
+        span.bandFirst = lastMatch + 1;
+        span.last = span.bandLast = std::min(n, lastMatch + 1 + shift);
+    } else {
+        span.first = span.bandFirst = std::max(0, firstMatch + shift);
+        span.bandLast = firstMatch;
+        span.last = lastMatch + 1;
+    }
+    for (int y = 0; y < n; y++) {
+        if (y >= span.bandFirst && y < span.bandLast) continue;
+        bool inPanel = y >= span.first && y < span.last;
+        if (inPanel ? cur[y] != prev[y + shift] : cur[y] != prev[y]) span.unexplained.push_back(y);
+    }
+    return true;
+}
+
+struct PanelShift {
+    int dx = 0;   // > 0 when content moved left
+    int dy = 0;   // > 0 when content moved up
+    ShiftSpan span;   // along the shifted axis: rows for dy, columns for dx
+};
+
+// Detects a pure vertical or horizontal content shift of one panel between
+// two equally sized crops. False when the change is anything else, in
+// which case the panel has to be analyzed again from scratch.
+static bool estimatePanelShift(const cv::Mat& prev, const cv::Mat& cur, PanelShift& shift) {
+    SM_TIMED_SCOPE("motion.estimate");
+    const int minLines = 4;
+    shift = PanelShift();
+    if (prev.size() != cur.size() || prev.type() != cur.type()) return false;
+    int d = 0;
+    auto prevRows = rowHashes(prev), curRows = rowHashes(cur);
+    if (estimateRowShift(prevRows, curRows, minLines, d) && shiftExplains(prevRows, curRows, d, shift.span)) {
+        shift.dy = d;
+        return true;
+    }
+    auto prevCols = columnHashes(prev), curCols = columnHashes(cur);
+    if (estimateRowShift(prevCols, curCols, minLines, d) && shiftExplains(prevCols, curCols, d, shift.span)) {
+        shift.dx = d;
+        return true;
+    }
+    return false;
+}
+
+// Merges rectangles whenever their union adds at most slack pixels to the
+// two areas, so a handful of captures or OCR crops cover scattered changes
+static std::vector<cv::Rect> mergeRects(std::vector<cv::Rect> rects, int slack) {
+    for (bool merged = true; merged;) {
+        merged = false;
+        for (size_t i = 0; i < rects.size() && !merged; i++) {
+            for (size_t j = i + 1; j < rects.size(); j++) {
+                cv::Rect both = rects[i] | rects[j];
+                if (both.area() <= rects[i].area() + rects[j].area() + slack) {
+                    rects[i] = both;
+                    rects.erase(rects.begin() + j);
+                    merged = true;
+                    break;
+                }
+            }
+        }
+    }
+    return rects;
+}
+
+// The panel a scroll at point moved, from the frames before and after it:
+// the changed tiles connected to the one under point, trimmed to the
+// columns that differ (so row hashes see only the panel). Empty when
+// nothing changed under point.
+static cv::Rect scrolledPanel(const cv::Mat& before, const cv::Mat& after, const cv::Point& point) {
+    if (before.size() != after.size() || before.type() != after.type()) return cv::Rect();
+    ChangeDetector detector;
+    detector.update(before);
+    auto changed = detector.update(after);
+    cv::Rect panel;
+    for (const auto& tile : changed) {
+        if (tile.contains(point)) panel = tile;
+    }
+    if (panel.empty()) return panel;
+    for (bool grew = true; grew;) {
+        grew = false;
+        cv::Rect reach(panel.x - 1, panel.y - 1, panel.width + 2, panel.height + 2);
+        for (const auto& tile : changed) {
+            if ((tile & reach).empty() || (tile & panel) == tile) continue;
+            panel |= tile;
+            grew = true;
+        }
+    }
+    auto was = columnHashes(before(panel)), now = columnHashes(after(panel));
+    int left = 0, right = panel.width;
+    while (left < right && was[left] == now[left]) left++;
+    while (right > left && was[right - 1] == now[right - 1]) right--;
+    return cv::Rect(panel.x + left, panel.y, right - left, panel.height);
+}
+
+// Keeps carets, spinners, clocks and progress bars, and the mouse cursor,
+// from invalidating cached analysis. A tile that changed kMinFlips times
+// within kWindowMs is animated; small groups of animated tiles are masked,
+// while larger ones (video, a panel being scrolled) still count as
+// content. Masked changes are held back and let through once the tile
+// stops changing, with the next real change, or after kRefreshMs, so
+// nothing stays stale for long. The cursor masks only while it moves.
+// Tiles under a keep rectangle (what a query is looking at) are never
+// masked. Feed it the output of a ChangeDetector with the same tile size.
+class ChangeFilter {
+private:
+    using Clock = std::chrono::steady_clock;
+    static constexpr int kMinFlips = 4;
+    static constexpr int kWindowMs = 4000;
+    static constexpr int kMaxAnimatedTiles = 16;
+    static constexpr int kRefreshMs = 2000;
+
+    int tileSize;
+    int cols = 0, rows = 0;
+    std::vector<int64_t> flipMs;     // last kMinFlips change times per tile, ring
+    std::vector<uint8_t> flipNext;
+    std::vector<uint8_t> pending;    // masked changes not yet let through
+    bool anyPending = false;
+    cv::Rect lastCursor;
+    Clock::time_point epoch = Clock::now(), lastRefresh = Clock::now();
+
+    uint64_t ticks = 0, rawHits = 0, filteredHits = 0, maskedTiles = 0;
+
+    int64_t nowMs() const {
+        return std::chrono::duration_cast<std::chrono::milliseconds>(Clock::now() - epoch).count();
+    }
+
+    bool animated(size_t tile, int64_t now) const {
+        int64_t oldest = flipMs[tile * kMinFlips + flipNext[tile]];
+        return oldest > 0 && now - oldest <= kWindowMs;
+    }
+
+public:
+    explicit ChangeFilter(int tileSize = 32) : tileSize(tileSize) {}
+
+    // Returns the changed tiles that should invalidate cached elements.
+    // cursor is the mouse cursor image in frame coordinates (may be empty).
+    std::vector<cv::Rect> filter(const std::vector<cv::Rect>& changed, const cv::Size& frameSize,
+                                 const cv::Rect& cursor = cv::Rect(),
+                                 const std::vector<cv::Rect>& keep = std::vector<cv::Rect>()) {
+        SM_TIMED_SCOPE("change_filter");
+        int c = (frameSize.width + tileSize - 1) / tileSize;
+        int r = (frameSize.height + tileSize - 1) / tileSize;
+        if (c != cols || r != rows) {
+            cols = c;
+            rows = r;
+            flipMs.assign(size_t(cols) * rows * kMinFlips, 0);
+            flipNext.assign(size_t(cols) * rows, 0);
+            pending.assign(size_t(cols) * rows, 0);
+            anyPending = false;
+            lastCursor = cv::Rect();
+        }
+
+        int64_t now = std::max<int64_t>(1, nowMs());
+        std::vector<uint8_t> flipped(size_t(cols) * rows, 0);
+        for (const auto& tile : changed) {
+            size_t i = size_t(tile.y / tileSize) * cols + tile.x / tileSize;
+            flipped[i] = 1;
+            flipMs[i * kMinFlips + flipNext[i]] = now;
+            flipNext[i] = (flipNext[i] + 1) % kMinFlips;
+        }
+
+        // Animated tiles, kept only in small 8-connected groups
+        std::vector<uint8_t> masked(size_t(cols) * rows, 0);
+        std::vector<uint8_t> seen(masked.size(), 0);
+        std::vector<size_t> group, stack;
+        for (size_t start = 0; start < masked.size(); start++) {
+            if (seen[start] || !animated(start, now)) continue;
+            group.clear();
+            stack.assign(1, start);
+            seen[start] = 1;
+            while (!stack.empty()) {
+                size_t i = stack.back();
+                stack.pop_back();
+                group.push_back(i);
+                int tx = int(i % cols), ty = int(i / cols);
+                for (int ny = std::max(0, ty - 1); ny <= std::min(rows - 1, ty + 1); ny++) {
+                    for (int nx = std::max(0, tx - 1); nx <= std::min(cols - 1, tx + 1); nx++) {
+                        size_t n = size_t(ny) * cols + nx;
+                        if (!seen[n] && animated(n, now)) {
+                            seen[n] = 1;
+                            stack.push_back(n);
+                        }
+                    }
+                }
+            }
+            if ((int)group.size() <= kMaxAnimatedTiles) {
+                for (size_t i : group) masked[i] = 1;
+            }
+        }
+
+        // Only a cursor that moved (or changed shape) explains the pixels
+        // under it; a still one over a changing tile hides nothing
+        cv::Rect cursorArea;
+        if (cursor != lastCursor) {
+            cursorArea = lastCursor.empty() ? cursor : cursor.empty() ? lastCursor : (cursor | lastCursor);
+        }
+        lastCursor = cursor;
+
+        std::vector<cv::Rect> out;
+        for (const auto& tile : changed) {
+            size_t i = size_t(tile.y / tileSize) * cols + tile.x / tileSize;
+            bool kept = false;
+            for (const auto& rect : keep) kept = kept || !(rect & tile).empty();
+            if (!kept && (masked[i] || !(cursorArea & tile).empty())) {
+                pending[i] = 1;
+                anyPending = true;
+                maskedTiles++;
+            } else {
+                out.push_back(tile);
+            }
+        }
+
+        // Held tiles go out with any real change or on the periodic refresh,
+        // and each on its own as soon as it stopped flipping: it has settled
+        // on what the cache must show
+        auto wall = Clock::now();
+        if (anyPending) {
+            bool all = !out.empty() || wall - lastRefresh >= std::chrono::milliseconds(kRefreshMs);
+            anyPending = false;
+            for (size_t i = 0; i < pending.size(); i++) {
+                if (!pending[i]) continue;
+                if (!all && flipped[i]) {
+                    anyPending = true;
+                    continue;
+                }
+                cv::Rect tile(int(i % cols) * tileSize, int(i / cols) * tileSize, tileSize, tileSize);
+                tile &= cv::Rect(0, 0, frameSize.width, frameSize.height);
+                // Also unmasked this tick (now kept): already let through
+                if (std::find(out.begin(), out.end(), tile) == out.end()) out.push_back(tile);
+                pending[i] = 0;
+            }
+        }
+        if (!out.empty()) lastRefresh = wall;
+
+        ticks++;
+        if (changed.empty()) rawHits++;
+        if (out.empty()) filteredHits++;
+        SM_COUNT("change_ticks", 1);
+        SM_COUNT("change_hits_raw", changed.empty() ? 1 : 0);
+        SM_COUNT("change_hits_filtered", out.empty() ? 1 : 0);
+        return out;
+    }
+
+    // Fraction of ticks on which cached elements stayed valid, with and
+    // without the filter
+    void report(std::ostream& out) const {
+        if (ticks == 0) return;
+        out << "Element cache hits: " << 100.0 * filteredHits / ticks << "% with change filter, "
+            << 100.0 * rawHits / ticks << "% without (" << maskedTiles << " tile changes masked)\n";
+    }
+};
+
+struct GovernorConfig {
+    int minIntervalMs = 33;      // polling period while the screen is changing
+    int maxIntervalMs = 2000;    // ceiling reached by backoff when idle
+    double backoff = 2.0;        // interval multiplier per idle tick
+    double cpuBudget = 0.10;     // fraction of one core the watcher may use
+};
+
+// Adapts the polling interval of a capture loop: snaps to the minimum
+// interval as soon as a change is seen, backs off exponentially while idle,
+// and never sleeps less than needed to stay within the CPU budget.
+class CaptureGovernor {
+private:
+    using Clock = std::chrono::steady_clock;
+
+    GovernorConfig config;
+    double intervalMs;
+    double avgWorkCpu = 0.0;
+    Clock::time_point startWall, lastTick;
+    double startCpu;
+    bool haveTick = false;
+
+    long ticks = 0, changes = 0;
+    double latencySumMs = 0.0, latencyMaxMs = 0.0;
+
+public:
+    explicit CaptureGovernor(const GovernorConfig& cfg = GovernorConfig())
+        : config(cfg), intervalMs(cfg.minIntervalMs),
+          startWall(Clock::now()), startCpu(processCpuSeconds()) {}
+
+    // Call once per tick after capture/analysis. tickStart is when the
+    // capture began; workCpu is the CPU time the tick consumed.
+    void endTick(Clock::time_point tickStart, bool changed, double workCpu) {
+        auto now = Clock::now();
+        ticks++;
+        avgWorkCpu = (ticks == 1) ? workCpu : 0.8 * avgWorkCpu + 0.2 * workCpu;
+
+        if (changed) {
+            // The change happened somewhere after the previous tick started,
+            // so the worst-case reaction latency spans back to that point.
+            auto since = haveTick ? lastTick : tickStart;
+            double latencyMs = std::chrono::duration<double, std::milli>(now - since).count();
+            if (ticks > 1) {
+                changes++;
+                latencySumMs += latencyMs;
+                latencyMaxMs = std::max(latencyMaxMs, latencyMs);
+            }
+            intervalMs = config.minIntervalMs;
+        } else {
+            intervalMs = std::min<double>(config.maxIntervalMs, intervalMs * config.backoff);
+        }
+
+        // work / (work + sleep) <= budget  =>  sleep >= work * (1 / budget - 1)
+        if (config.cpuBudget > 0.0) {
+            double budgetSleepMs = avgWorkCpu * 1000.0 * (1.0 / config.cpuBudget - 1.0);
+            intervalMs = std::max(intervalMs, budgetSleepMs);
+        }
+
+        lastTick = tickStart;
+        haveTick = true;
+    }
+
+    std::chrono::milliseconds nextDelay() const {
+        return std::chrono::milliseconds((long)intervalMs);
+    }
+
+    double cpuUsage() const {
+        double wall = std::chrono::duration<double>(Clock::now() - startWall).count();
+        return wall > 0.0 ? (processCpuSeconds() - startCpu) / wall : 0.0;
+    }
+
+    void report(std::ostream& out) const {
+        out << "Watch ticks: " << ticks << ", changes: " << changes << "\n";
+        if (changes > 0) {
+            out << "Reaction latency: avg " << latencySumMs / changes
+                << " ms, max " << latencyMaxMs << " ms\n";
+        }
+        out << "CPU usage: " << cpuUsage() * 100.0 << "% of one core (budget "
+            << config.cpuBudget * 100.0 << "%)\n";
+        out << "Current interval: " << (long)intervalMs << " ms\n";
+    }
+};
+
+// ============================================================================
+// REGION WATCHERS
+// ============================================================================
+
+enum class WatchKind { Change, Color, Template, Text };
+
+struct RegionWatch {
+    std::string name;
+    cv::Rect region;
+    WatchKind kind = WatchKind::Change;
+    int intervalMs = 250;       // evaluated at most this often
+    cv::Scalar color;           // Color: BGR to look for
+    int tolerance = 16;         // Color: per-channel distance
+    double fraction = 0.05;     // Color: share of the region that must match
+    cv::Mat templ;              // Template: image to find inside the region
+    double threshold = 0.8;     // Template: normalized correlation
+    std::string text;           // Text: substring, case-insensitive
+};
+
+struct WatchEvent {
+    std::string name;
+    double timeMs;              // since the watcher started
+    std::string detail;
+};
+
+// Serves many small watched regions from one loop. Each tick captures only
+// the regions that are due (nearby ones merged into one capture), evaluates
+// their predicates in parallel and calls back in registration order. Change
+// watches fire on every change; the others when their predicate turns true.
+class RegionWatcher {
+private:
+    using Clock = std::chrono::steady_clock;
+
+    struct Entry {
+        RegionWatch watch;
+        std::function<void(const WatchEvent&)> callback;
+        Clock::time_point nextDue;
+        int session = 0;            // OCR fairness queue of a Text watch
+        uint64_t hash = 0;
+        bool evaluated = false;
+        bool active = false;        // predicate result of the last evaluation
+        uint64_t evaluations = 0, fired = 0;
+    };
+
+    struct Result {
+        bool fire = false;
+        std::string detail;
+    };
+
+    // Merging two captures is worth it while the union adds no more than
+    // this many pixels to their areas
+    static constexpr int kMergeSlack = 64 * 64;
+    static constexpr int kParallelPixels = 1 << 18;
+
+    ScreenBackend& screen;
+    std::shared_ptr<OcrPool> pool;
+    std::function<cv::Mat(const cv::Rect&)> grab;
+    std::vector<Entry> entries;
+    Clock::time_point start = Clock::now();
+    uint64_t ticks = 0, captures = 0, capturedPixels = 0;
+
+    // Threads for the pixel predicates, started on the first tick that
+    // needs them and kept for the watcher's lifetime
+    std::vector<std::thread> workers;
+    std::mutex workMutex;
+    std::condition_variable workReady, workDone;
+    std::function<void(size_t)> work;
+    size_t nextPart = 0, parts = 0, partsDone = 0;
+    bool stopping = false;
+
+    void workerLoop() {
+        Tracer::setThreadName("region worker");
+        std::unique_lock<std::mutex> lock(workMutex);
+        while (true) {
+            workReady.wait(lock, [&] { return stopping || nextPart < parts; });
+            if (stopping) break;
+            size_t part = nextPart++;
+            lock.unlock();
+            work(part);
+            lock.lock();
+            if (++partsDone == parts) workDone.notify_all();
+        }
+    }
+
+    // Runs fn(0) .. fn(count - 1) on the workers and this thread. Every
+    // part runs even if another throws; the first part's exception (by
+    // index) is rethrown once all are done.
+    void parallelFor(size_t count, std::function<void(size_t)> fn) {
+        if (workers.empty()) {
+            size_t threads = std::max(2u, std::thread::hardware_concurrency()) - 1;
+            for (size_t i = 0; i < threads; i++) workers.emplace_back(&RegionWatcher::workerLoop, this);
+        }
+        std::vector<std::exception_ptr> errors(count);
+        std::unique_lock<std::mutex> lock(workMutex);
+        work = [&](size_t part) {
+            try {
+                fn(part);
+            } catch (...) {
+                errors[part] = std::current_exception();
+            }
+        };
+        nextPart = partsDone = 0;
+        parts = count;
+        workReady.notify_all();
+        while (nextPart < parts) {
+            size_t part = nextPart++;
+            lock.unlock();
+            work(part);
+            lock.lock();
+            partsDone++;
+        }
+        workDone.wait(lock, [&] { return partsDone == parts; });
+        parts = 0;
+        work = nullptr;
+        lock.unlock();
+        for (const auto& error : errors) {
+            if (error) std::rethrow_exception(error);
+        }
+    }
+
+    static Result evaluate(Entry& e, const cv::Mat& pixels) {
+        Result result;
+        const RegionWatch& w = e.watch;
+        bool now = false;
+        switch (w.kind) {
+            case WatchKind::Change: {
+                uint64_t h = 0;
+                for (int y = 0; y < pixels.rows; y++) {
+                    h = hashBytes(pixels.ptr(y), pixels.cols * pixels.elemSize(), h + y);
+                }
+                result.fire = e.evaluated && h != e.hash;
+                e.hash = h;
+                result.detail = "changed";
+                e.evaluated = true;
+                return result;
+            }
+            case WatchKind::Color: {
+                cv::Mat mask;
+                double t = w.tolerance;
+                cv::Scalar lo(w.color[0] - t, w.color[1] - t, w.color[2] - t);
+                cv::Scalar hi(w.color[0] + t, w.color[1] + t, w.color[2] + t);
+                cv::inRange(pixels, lo, hi, mask);
+                double share = (double)cv::countNonZero(mask) / std::max(1, pixels.rows * pixels.cols);
+                now = share >= w.fraction;
+                result.detail = "color " + std::to_string((int)std::round(share * 100)) + "%";
+                break;
+            }
+            case WatchKind::Template: {
+                if (pixels.cols < w.templ.cols || pixels.rows < w.templ.rows) break;
+                cv::Mat scores;
+                cv::matchTemplate(pixels, w.templ, scores, cv::TM_CCOEFF_NORMED);
+                double best = 0.0;
+                cv::Point at;
+                cv::minMaxLoc(scores, nullptr, &best, nullptr, &at);
+                now = best >= w.threshold;
+                result.detail = "template " + std::to_string(best) + " at " + std::to_string(w.region.x + at.x) + "," +
+                                std::to_string(w.region.y + at.y);
+                break;
+            }
+            case WatchKind::Text:
+                break;   // resolved from the OCR job by the caller
+        }
+        result.fire = now && !e.active;
+        e.active = now;
+        e.evaluated = true;
+        return result;
+    }
+
+    static Result textResult(Entry& e, const std::string& text) {
+        auto lower = [](std::string s) {
+            std::transform(s.begin(), s.end(), s.begin(), ::tolower);
+            return s;
+        };
+        bool now = lower(text).find(lower(e.watch.text)) != std::string::npos;
+        Result result{now && !e.active, "text \"" + tsvField(text) + "\""};
+        e.active = now;
+        e.evaluated = true;
+        return result;
+    }
+
+public:
+    // pool is needed only for Text watches; capture replaces the backend's
+    // captureRegion, e.g. to keep a live overlay out of the pixels
+    explicit RegionWatcher(ScreenBackend& backend, std::shared_ptr<OcrPool> ocr = nullptr,
+                           std::function<cv::Mat(const cv::Rect&)> capture = nullptr)
+        : screen(backend), pool(std::move(ocr)), grab(std::move(capture)) {
+        if (!grab) grab = [this](const cv::Rect& rect) { return screen.captureRegion(rect); };
+    }
+
+    ~RegionWatcher() {
+        {
+            std::lock_guard<std::mutex> lock(workMutex);
+            stopping = true;
+        }
+        workReady.notify_all();
+        for (auto& worker : workers) worker.join();
+        for (const auto& e : entries) {
+            if (e.watch.kind == WatchKind::Text) pool->removeSession(e.session);
+        }
+    }
+
+    RegionWatcher(const RegionWatcher&) = delete;
+    RegionWatcher& operator=(const RegionWatcher&) = delete;
+
+    void add(RegionWatch watch, std::function<void(const WatchEvent&)> callback) {
+        auto size = screen.getScreenSize();
+        watch.region &= cv::Rect(0, 0, size.first, size.second);
+        if (watch.region.empty()) throw std::runtime_error("Watch " + watch.name + " is outside the screen");
+        if (watch.kind == WatchKind::Text && !pool) throw std::runtime_error("Watch " + watch.name + " needs OCR");
+        if (watch.kind == WatchKind::Template && watch.templ.empty()) {
+            throw std::runtime_error("Watch " + watch.name + " has no template");
+        }
+        watch.intervalMs = std::max(1, watch.intervalMs);
+        // Each text watch queues on its own, so a heavy region cannot starve the rest
+        int session = watch.kind == WatchKind::Text ? pool->addSession() : 0;
+        entries.push_back({std::move(watch), std::move(callback), Clock::now(), session});
+    }
+
+    size_t size() const { return entries.size(); }
+
+    // Evaluates every due watch once; returns the number evaluated
+    size_t tick() {
+        SM_TIMED_SCOPE("regions.tick");
+        auto now = Clock::now();
+        std::vector<size_t> due;
+        std::vector<cv::Rect> rects;
+        for (size_t i = 0; i < entries.size(); i++) {
+            if (entries[i].nextDue > now) continue;
+            due.push_back(i);
+            rects.push_back(entries[i].watch.region);
+        }
+        if (due.empty()) return 0;
+        ticks++;
+
+        std::vector<std::pair<cv::Rect, cv::Mat>> frames;
+        for (const auto& rect : mergeRects(rects, kMergeSlack)) {
+            frames.emplace_back(rect, grab(rect));
+            captures++;
+            capturedPixels += rect.area();
+        }
+        std::vector<cv::Mat> views(due.size());
+        int pixels = 0;
+        for (size_t d = 0; d < due.size(); d++) {
+            const cv::Rect& region = entries[due[d]].watch.region;
+            for (const auto& frame : frames) {
+                if ((frame.first & region) == region) {
+                    views[d] = frame.second(region - frame.first.tl());
+                    break;
+                }
+            }
+            pixels += region.area();
+        }
+
+        // OCR runs on the pool meanwhile; the pixel predicates are split over
+        // threads once there are enough pixels to pay for them
+        std::vector<std::future<OcrResult>> ocr(due.size());
+        for (size_t d = 0; d < due.size(); d++) {
+            if (entries[due[d]].watch.kind == WatchKind::Text) ocr[d] = pool->submit(views[d], OcrMode::Text, entries[due[d]].session);
+        }
+        std::vector<Result> results(due.size());
+        auto evaluateRange = [&](size_t begin, size_t end) {
+            for (size_t d = begin; d < end; d++) {
+                if (entries[due[d]].watch.kind != WatchKind::Text) results[d] = evaluate(entries[due[d]], views[d]);
+            }
+        };
+        size_t threads = pixels >= kParallelPixels ? std::min<size_t>(due.size(), std::thread::hardware_concurrency()) : 1;
+        if (threads > 1) {
+            size_t chunk = (due.size() + threads - 1) / threads;
+            parallelFor((due.size() + chunk - 1) / chunk, [&](size_t part) {
+                evaluateRange(part * chunk, std::min(due.size(), (part + 1) * chunk));
+            });
+        } else {
+            evaluateRange(0, due.size());
+        }
+        for (size_t d = 0; d < due.size(); d++) {
+            if (ocr[d].valid()) results[d] = textResult(entries[due[d]], ocr[d].get().text);
+        }
+
+        double timeMs = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+        for (size_t d = 0; d < due.size(); d++) {
+            Entry& e = entries[due[d]];
+            e.evaluations++;
+            e.nextDue = now + std::chrono::milliseconds(e.watch.intervalMs);
+            if (!results[d].fire) continue;
+            e.fired++;
+            SM_COUNT("region_events", 1);
+            if (e.callback) e.callback({e.watch.name, timeMs, results[d].detail});
+        }
+        return due.size();
+    }
+
+    // Ticks until seconds have passed, sleeping until the next watch is due
+    void run(double seconds) {
+        auto deadline = Clock::now() + std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(seconds));
+        while (Clock::now() < deadline) {
+            tick();
+            Clock::time_point next = deadline;
+            for (const auto& e : entries) next = std::min(next, e.nextDue);
+            if (next > Clock::now()) {
+                SM_TIMED_SCOPE("regions.sleep");
+                std::this_thread::sleep_until(next);
+            }
+        }
+    }
+
+    void report(std::ostream& out) const {
+        auto size = screen.getScreenSize();
+        double screenPixels = (double)size.first * size.second;
+        out << "Region ticks: " << ticks << ", captures: " << captures << ", pixels per tick: "
+            << (ticks ? capturedPixels / ticks : 0) << " ("
+            << (ticks ? 100.0 * capturedPixels / ticks / screenPixels : 0.0) << "% of the screen)\n";
+        for (const auto& e : entries) {
+            out << "  " << e.watch.name << ": " << e.evaluations << " evaluations, " << e.fired << " events\n";
+        }
+    }
+};
+
+// Watch list TSV: name, x, y, width, height, interval_ms, kind, arguments
+//   change
+//   color     <b,g,r> [tolerance] [fraction]
+//   template  <image> [threshold]
+//   text      <substring>
+static std::vector<RegionWatch> loadRegionWatches(const std::string& path) {
+    std::ifstream in(path);
+    if (!in) throw std::runtime_error("Cannot read " + path);
+    std::vector<RegionWatch> watches;
+    std::string line;
+    for (int n = 1; std::getline(in, line); n++) {
+        if (line.empty() || line[0] == '#') continue;
+        auto f = splitTabs(line);
+        if (f.size() < 7) throw std::runtime_error(path + ":" + std::to_string(n) + ": expected at least 7 fields");
+        RegionWatch w;
+        w.name = f[0];
+        w.region = cv::Rect(std::stoi(f[1]), std::stoi(f[2]), std::stoi(f[3]), std::stoi(f[4]));
+        w.intervalMs = std::stoi(f[5]);
+        const std::string& kind = f[6];
+        if (kind == "change") {
+            w.kind = WatchKind::Change;
+        } else if (kind == "color" && f.size() > 7) {
+            w.kind = WatchKind::Color;
+            int b = 0, g = 0, r = 0;
+            std::sscanf(f[7].c_str(), "%d,%d,%d", &b, &g, &r);
+            w.color = cv::Scalar(b, g, r);
+            if (f.size() > 8) w.tolerance = std::stoi(f[8]);
+            if (f.size() > 9) w.fraction = std::stod(f[9]);
+        } else if (kind == "template" && f.size() > 7) {
+            w.kind = WatchKind::Template;
+            w.templ = cv::imread(f[7], cv::IMREAD_COLOR);
+            if (w.templ.empty()) throw std::runtime_error("Cannot read template " + f[7]);
+            if (f.size() > 8) w.threshold = std::stod(f[8]);
+        } else if (kind == "text" && f.size() > 7) {
+            w.kind = WatchKind::Text;
+            w.text = f[7];
+        } else {
+            throw std::runtime_error(path + ":" + std::to_string(n) + ": bad watch kind " + kind);
+        }
+        watches.push_back(w);
+    }
+    return watches;
+}
+
+// Adds watches to watcher, printing time_ms, name, detail per event to out
+static void addRegionWatches(RegionWatcher& watcher, const std::vector<RegionWatch>& watches, std::ostream& out) {
+    for (auto& w : watches) {
+        watcher.add(w, [&out](const WatchEvent& event) {
+            out << std::fixed << std::setprecision(1) << event.timeMs << std::setprecision(6) << std::defaultfloat
+                << "\t" << event.name << "\t" << event.detail << std::endl;
+        });
+    }
+}
+
+// regions <watches.tsv> [seconds]
+static void runRegionWatches(const std::string& path, double seconds, const std::string& displayName,
+                             const OcrPoolConfig& ocr, std::ostream& out) {
+    auto watches = loadRegionWatches(path);
+    bool needsOcr = std::any_of(watches.begin(), watches.end(), [](const RegionWatch& w) {
+        return w.kind == WatchKind::Text;
+    });
+    auto screen = makeScreenBackend(displayName);
+    RegionWatcher watcher(*screen, needsOcr ? std::make_shared<OcrPool>(ocr) : nullptr);
+    addRegionWatches(watcher, watches, out);
+    watcher.run(seconds);
+    watcher.report(std::cerr);
+}
+
+// ============================================================================
+// SESSION RECORDING & REPLAY
+// ============================================================================
+
+// Creates dir if missing (one level); true if it exists afterwards
+static bool makeDirectory(const std::string& dir) {
+#ifdef _WIN32
+    return CreateDirectoryA(dir.c_str(), NULL) || GetLastError() == ERROR_ALREADY_EXISTS;
+#else
+    return mkdir(dir.c_str(), 0755) == 0 || errno == EEXIST;
+#endif
+}
+
+// Payload codecs of a recorded frame
+enum class FrameCodec : uint8_t { Raw = 0, Zstd = 1, Png = 2 };
+
+// frames.bin: "SMREC1" magic, then one header per frame followed by its
+// tile coordinates (deltas only) and the compressed pixels. A keyframe's
+// payload is the whole BGR frame; a delta's is the changed tiles' pixels,
+// row by row, in the listed order.
+struct RecordedFrameHeader {
+    uint32_t index;
+    uint8_t keyframe;
+    uint8_t codec;
+    uint16_t tileSize;
+    uint64_t timeUs;        // since the recording started
+    int32_t width, height;
+    uint32_t tileCount;
+    uint32_t reserved;      // zero; keeps the 64-bit fields aligned without hidden padding
+    uint64_t rawBytes, payloadBytes;
+};
+static_assert(sizeof(RecordedFrameHeader) == 48, "frames.bin headers are written raw and must have no padding");
+
+static const char kRecordingMagic[8] = {'S', 'M', 'R', 'E', 'C', '1', 0, 0};
+
+// Records captured frames as keyframes plus changed 32x32 tiles, compressed
+// and written by a background thread, and every command, element list and
+// input action into events.tsv with the index of the frame it refers to.
+class SessionRecorder {
+private:
+    struct PendingFrame {
+        uint32_t index;
+        uint64_t timeUs;
+        cv::Mat frame;
+    };
+
+    std::ofstream frames, events;
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    int keyframeInterval;
+    ChangeDetector detector;
+    cv::Size lastSize;
+    int sinceKeyframe = 0;
+    long currentFrame = -1;
+
+    std::thread writer;
+    std::mutex mutex, eventMutex;
+    std::condition_variable queued, drained;
+    std::deque<PendingFrame> queue;
+    bool stopping = false;
+    std::atomic<uint64_t> rawTotal{0}, storedTotal{0}, keyframes{0};
+
+    static constexpr int kTileSize = 32;
+    static constexpr size_t kMaxQueued = 4;   // capture blocks beyond this
+
+    uint64_t elapsedUs() const {
+        return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    // width: pixels per row of the PNG fallback (the frame's for keyframes)
+    static std::vector<uint8_t> compress(const std::vector<uint8_t>& raw, int width, FrameCodec& codec) {
+#ifdef SMART_MOUSE_HAVE_ZSTD
+        (void)width;
+        std::vector<uint8_t> out(ZSTD_compressBound(raw.size()));
+        size_t n = ZSTD_compress(out.data(), out.size(), raw.data(), raw.size(), 3);
+        if (!ZSTD_isError(n)) {
+            out.resize(n);
+            codec = FrameCodec::Zstd;
+            return out;
+        }
+#else
+        // Without zstd, OpenCV's PNG encoder provides deflate; the last row
+        // is padded and the reader trims back to rawBytes
+        int rowBytes = width * 3;
+        std::vector<uint8_t> padded(raw);
+        padded.resize((raw.size() + rowBytes - 1) / rowBytes * rowBytes);
+        cv::Mat image((int)(padded.size() / rowBytes), width, CV_8UC3, padded.data());
+        std::vector<uint8_t> out;
+        if (cv::imencode(".png", image, out, {cv::IMWRITE_PNG_COMPRESSION, 1}) && out.size() < raw.size()) {
+            codec = FrameCodec::Png;
+            return out;
+        }
+#endif
+        codec = FrameCodec::Raw;
+        return raw;
+    }
+
+    void encode(const PendingFrame& pending) {
+        SM_TIMED_SCOPE("record.encode");
+        const cv::Mat& frame = pending.frame;
+        auto changed = detector.update(frame);
+        bool keyframe = frame.size() != lastSize || ++sinceKeyframe >= keyframeInterval;
+        if (keyframe) {
+            lastSize = frame.size();
+            sinceKeyframe = 0;
+            changed.clear();
+        }
+
+        std::vector<uint8_t> raw;
+        std::vector<uint16_t> coords;
+        if (keyframe) {
+            for (int y = 0; y < frame.rows; y++) raw.insert(raw.end(), frame.ptr(y), frame.ptr(y) + frame.cols * 3);
+        } else {
+            for (const auto& tile : changed) {
+                coords.push_back(uint16_t(tile.x / kTileSize));
+                coords.push_back(uint16_t(tile.y / kTileSize));
+                for (int y = tile.y; y < tile.y + tile.height; y++) {
+                    const uint8_t* row = frame.ptr(y) + tile.x * frame.elemSize();
+                    raw.insert(raw.end(), row, row + tile.width * frame.elemSize());
+                }
+            }
+        }
+
+        FrameCodec codec = FrameCodec::Raw;
+        std::vector<uint8_t> payload = raw.empty() ? raw : compress(raw, keyframe ? frame.cols : kTileSize, codec);
+
+        RecordedFrameHeader header{pending.index, uint8_t(keyframe), uint8_t(codec), uint16_t(kTileSize),
+                                   pending.timeUs, frame.cols, frame.rows, uint32_t(changed.size()), 0,
+                                   raw.size(), payload.size()};
+        frames.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        frames.write(reinterpret_cast<const char*>(coords.data()), coords.size() * sizeof(uint16_t));
+        frames.write(reinterpret_cast<const char*>(payload.data()), payload.size());
+        rawTotal += raw.size();
+        storedTotal += sizeof(header) + coords.size() * sizeof(uint16_t) + payload.size();
+        if (keyframe) keyframes++;
+    }
+
+    void writerLoop() {
+        Tracer::setThreadName("recorder");
+        std::unique_lock<std::mutex> lock(mutex);
+        while (true) {
+            queued.wait(lock, [&] { return stopping || !queue.empty(); });
+            if (queue.empty()) break;
+            PendingFrame pending = std::move(queue.front());
+            queue.pop_front();
+            drained.notify_all();
+            lock.unlock();
+            encode(pending);
+            lock.lock();
+        }
+        frames.flush();
+    }
+
+    void event(const std::string& fields) {
+        std::lock_guard<std::mutex> lock(eventMutex);
+        events << elapsedUs() << "\t" << currentFrame << "\t" << fields << "\n";
+    }
+
+public:
+    explicit SessionRecorder(const std::string& dir, int keyframeEvery = 120)
+        : keyframeInterval(std::max(1, keyframeEvery)), detector(kTileSize) {
+        if (!makeDirectory(dir)) throw std::runtime_error("Cannot create recording directory " + dir);
+        frames.open(dir + "/frames.bin", std::ios::binary);
+        events.open(dir + "/events.tsv");
+        if (!frames || !events) throw std::runtime_error("Cannot write recording in " + dir);
+        frames.write(kRecordingMagic, sizeof(kRecordingMagic));
+        events << "# time_us\tframe\tkind\tfields...\n";
+        writer = std::thread(&SessionRecorder::writerLoop, this);
+    }
+
+    ~SessionRecorder() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        queued.notify_all();
+        writer.join();
+        events.flush();
+    }
+
+    // Queues a captured BGR frame (shared, not copied; captures are never
+    // written to afterwards) and makes it the frame later events refer to
+    void addFrame(const cv::Mat& frame) {
+        if (frame.type() != CV_8UC3) throw std::runtime_error("Recorder expects BGR frames");
+        std::unique_lock<std::mutex> lock(mutex);
+        drained.wait(lock, [&] { return queue.size() < kMaxQueued; });
+        std::lock_guard<std::mutex> eventLock(eventMutex);
+        queue.push_back({uint32_t(++currentFrame), elapsedUs(), frame});
+        queued.notify_one();
+    }
+
+    void command(const std::string& name, const std::string& argument) {
+        event("command\t" + name + "\t" + tsvField(argument));
+    }
+
+    void elements(const std::vector<UIElement>& list) {
+        event("elements\t" + std::to_string(list.size()));
+        for (const auto& elem : list) {
+            std::ostringstream line;
+            line << "element\t" << elem.type << "\t" << elem.bounds.x << "\t" << elem.bounds.y << "\t"
+                 << elem.bounds.width << "\t" << elem.bounds.height << "\t" << elem.confidence << "\t"
+                 << tsvField(elem.text);
+            event(line.str());
+        }
+    }
+
+    void input(const std::string& action, cv::Point at) {
+        event("input\t" + action + "\t" + std::to_string(at.x) + "\t" + std::to_string(at.y));
+    }
+
+    void report(std::ostream& out) const {
+        out << "Recorded " << currentFrame + 1 << " frames (" << keyframes << " keyframes): "
+            << rawTotal / (1024 * 1024) << " MB of changed pixels stored in " << storedTotal / 1024 << " KB\n";
+    }
+};
+
+// Reads frames.bin back, rebuilding every frame from its keyframe and deltas
+class RecordingReader {
+private:
+    std::ifstream in;
+    cv::Mat current;
+
+    static std::vector<uint8_t> decompress(const std::vector<uint8_t>& payload, const RecordedFrameHeader& h) {
+        std::vector<uint8_t> raw;
+        switch ((FrameCodec)h.codec) {
+            case FrameCodec::Raw:
+                return payload;
+            case FrameCodec::Zstd:
+#ifdef SMART_MOUSE_HAVE_ZSTD
+                raw.resize(h.rawBytes);
+                if (ZSTD_isError(ZSTD_decompress(raw.data(), raw.size(), payload.data(), payload.size()))) break;
+                return raw;
+#else
+                throw std::runtime_error("Recording uses zstd; rebuild with SMART_MOUSE_ZSTD");
+#endif
+            case FrameCodec::Png: {
+                cv::Mat decoded = cv::imdecode(payload, cv::IMREAD_UNCHANGED);
+                if (decoded.empty() || !decoded.isContinuous() || decoded.total() * decoded.elemSize() < h.rawBytes) break;
+                raw.assign(decoded.data, decoded.data + h.rawBytes);
+                return raw;
+            }
+        }
+        throw std::runtime_error("Corrupt frame " + std::to_string(h.index) + " in recording");
+    }
+
+public:
+    explicit RecordingReader(const std::string& dir) : in(dir + "/frames.bin", std::ios::binary) {
+        char magic[sizeof(kRecordingMagic)];
+        if (!in.read(magic, sizeof(magic)) || std::memcmp(magic, kRecordingMagic, sizeof(magic)) != 0) {
+            throw std::runtime_error("Not a recording: " + dir);
+        }
+    }
+
+    // Returns false at the end of the recording; frame stays valid until the
+    // next call (deltas are applied in place)
+    bool next(cv::Mat& frame, RecordedFrameHeader& header) {
+        SM_TIMED_SCOPE("replay.decode");
+        if (!in.read(reinterpret_cast<char*>(&header), sizeof(header))) return false;
+        std::vector<uint16_t> coords(size_t(header.tileCount) * 2);
+        std::vector<uint8_t> payload(header.payloadBytes);
+        in.read(reinterpret_cast<char*>(coords.data()), coords.size() * sizeof(uint16_t));
+        in.read(reinterpret_cast<char*>(payload.data()), payload.size());
+        if (!in) throw std::runtime_error("Truncated recording at frame " + std::to_string(header.index));
+        std::vector<uint8_t> raw = payload.empty() ? payload : decompress(payload, header);
+
+        if (header.keyframe) {
+            current.create(header.height, header.width, CV_8UC3);
+            if (raw.size() != current.total() * current.elemSize()) {
+                throw std::runtime_error("Bad keyframe " + std::to_string(header.index));
+            }
+            std::memcpy(current.data, raw.data(), raw.size());
+        } else {
+            if (current.empty()) throw std::runtime_error("Recording starts without a keyframe");
+            size_t offset = 0;
+            for (size_t i = 0; i < coords.size(); i += 2) {
+                cv::Rect tile(coords[i] * header.tileSize, coords[i + 1] * header.tileSize, header.tileSize, header.tileSize);
+                tile &= cv::Rect(0, 0, current.cols, current.rows);
+                size_t rowBytes = tile.width * current.elemSize();
+                for (int y = tile.y; y < tile.y + tile.height; y++, offset += rowBytes) {
+                    if (offset + rowBytes > raw.size()) throw std::runtime_error("Bad delta " + std::to_string(header.index));
+                    std::memcpy(current.ptr(y) + tile.x * current.elemSize(), raw.data() + offset, rowBytes);
+                }
+            }
+        }
+        frame = current;
+        return true;
+    }
+};
+
+// Feeds a recording back through SmartVision: every frame that was analyzed
+// is analyzed again, and every recorded click target is matched again and
+// compared with where the original run clicked. Non-zero if any diverged.
+static int replayRecording(const std::string& dir, const OcrPoolConfig& ocr, std::ostream& out) {
+    struct Event {
+        std::string kind;
+        std::vector<std::string> fields;
+    };
+    std::map<long, std::vector<Event>> byFrame;
+    std::ifstream events(dir + "/events.tsv");
+    if (!events) throw std::runtime_error("No events.tsv in " + dir);
+    std::string line;
+    while (std::getline(events, line)) {
+        auto f = splitTabs(line);
+        if (line.empty() || line[0] == '#' || f.size() < 3) continue;
+        byFrame[std::stol(f[1])].push_back({f[2], std::vector<std::string>(f.begin() + 3, f.end())});
+    }
+
+    OcrPoolConfig config = ocr;
+    config.blockingInit = true;
+    SmartVision vision(std::make_shared<OcrPool>(config));
+    RecordingReader reader(dir);
+    cv::Mat frame;
+    RecordedFrameHeader header;
+    std::vector<double> analyzeMs;
+    int frameCount = 0, mismatches = 0;
+
+    while (reader.next(frame, header)) {
+        frameCount++;
+        auto it = byFrame.find(header.index);
+        if (it == byFrame.end()) continue;
+
+        std::vector<UIElement> elements;
+        std::string query;
+        for (const auto& event : it->second) {
+            if (event.kind == "elements" && !event.fields.empty()) {
+                auto t0 = std::chrono::steady_clock::now();
+                elements = vision.analyzeScreen(frame);
+                analyzeMs.push_back(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t0).count());
+                if ((int)elements.size() != std::stoi(event.fields[0])) {
+                    out << "frame " << header.index << ": " << elements.size() << " elements, recorded "
+                        << event.fields[0] << "\n";
+                }
+            } else if (event.kind == "command" && event.fields.size() > 1) {
+                query = event.fields[1];
+            } else if (event.kind == "input" && event.fields.size() > 2 && !query.empty() &&
+                       event.fields[0] != "wheel") {
+                cv::Point recorded(std::stoi(event.fields[1]), std::stoi(event.fields[2]));
+                UIElement* match = vision.findBestMatch(elements, query);
+                if (!match || match->center() != recorded) {
+                    mismatches++;
+                    out << "frame " << header.index << ": '" << query << "' now "
+                        << (match ? "at (" + std::to_string(match->center().x) + ", " +
+                                        std::to_string(match->center().y) + ")" : std::string("not found"))
+                        << ", recorded " << event.fields[0] << " at (" << recorded.x << ", " << recorded.y << ")\n";
+                }
+            }
+        }
+    }
+
+    std::sort(analyzeMs.begin(), analyzeMs.end());
+    out << "Replayed " << frameCount << " frames, re-analyzed " << analyzeMs.size() << ", "
+        << mismatches << " diverging click targets\n";
+    if (!analyzeMs.empty()) {
+        out << "analyzeScreen p50 " << analyzeMs[analyzeMs.size() / 2] << " ms, p99 "
+            << analyzeMs[std::min(analyzeMs.size() - 1, analyzeMs.size() * 99 / 100)] << " ms\n";
+    }
+    return mismatches == 0 ? 0 : 1;
+}
+
+// ============================================================================
+// FRAME HISTORY
+// ============================================================================
+
+struct HistoryConfig {
+    double seconds = 60.0;              // frames older than this are dropped
+    size_t maxBytes = 256u << 20;       // hard cap on tile and index memory
+    bool compress = true;               // zstd level 1 per tile, when built with zstd
+    int tileSize = 32;
+};
+
+// Recent frames stored as content-addressed tiles: each distinct tile is kept
+// once (keyed by hash and size) and shared by every frame that contains it,
+// so an idle 4K desktop costs one frame plus a small index per capture.
+// Oldest frames are evicted to stay within both the time window and the cap.
+// Frames are hashed and stored on a background thread, like the session
+// recorder's, so capture loops only pay for queueing a shared reference.
+class FrameHistory {
+private:
+    using Clock = std::chrono::steady_clock;
+
+    struct PendingFrame {
+        Clock::time_point time;
+        cv::Mat frame;
+    };
+
+    struct Tile {
+        std::vector<uint8_t> data;
+        uint32_t refs = 0;
+        bool compressed = false;
+    };
+    struct Frame {
+        Clock::time_point time;
+        cv::Size size;
+        int type;
+        std::vector<uint64_t> tiles;   // row-major tile keys
+    };
+
+    HistoryConfig config;
+    mutable std::mutex mutex;
+    std::unordered_map<uint64_t, Tile> tiles;
+    std::deque<Frame> frames;
+    size_t bytes = 0;
+    uint64_t tilesAdded = 0, tilesShared = 0;
+    uint64_t framesEvicted = 0;
+
+    std::thread storer;
+    std::mutex queueMutex;
+    std::condition_variable queued, drained;
+    std::deque<PendingFrame> queue;
+    bool storing = false, stopping = false;
+    uint64_t framesDropped = 0;
+
+    static constexpr size_t kTileOverhead = 64;   // map node and vector header, roughly
+    static constexpr size_t kMaxQueued = 4;       // newer frames are dropped beyond this
+
+    size_t frameBytes(const Frame& frame) const { return sizeof(Frame) + frame.tiles.size() * sizeof(uint64_t); }
+
+    void release(const Frame& frame) {
+        for (uint64_t key : frame.tiles) {
+            auto it = tiles.find(key);
+            if (--it->second.refs == 0) {
+                bytes -= it->second.data.size() + kTileOverhead;
+                tiles.erase(it);
+            }
+        }
+        bytes -= frameBytes(frame);
+    }
+
+    void evict(Clock::time_point now) {
+        auto window = std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(config.seconds));
+        while (!frames.empty() && (bytes > config.maxBytes || now - frames.front().time > window)) {
+            release(frames.front());
+            frames.pop_front();
+            framesEvicted++;
+        }
+    }
+
+    cv::Mat rebuild(const Frame& frame) const {
+        cv::Mat out(frame.size, frame.type);
+        int cols = (frame.size.width + config.tileSize - 1) / config.tileSize;
+        std::vector<uint8_t> buffer;
+        for (size_t i = 0; i < frame.tiles.size(); i++) {
+            cv::Rect rect(int(i % cols) * config.tileSize, int(i / cols) * config.tileSize, config.tileSize, config.tileSize);
+            rect &= cv::Rect(0, 0, frame.size.width, frame.size.height);
+            size_t rowBytes = rect.width * out.elemSize();
+            const Tile& tile = tiles.at(frame.tiles[i]);
+            const uint8_t* src = tile.data.data();
+#ifdef SMART_MOUSE_HAVE_ZSTD
+            if (tile.compressed) {
+                buffer.resize(rowBytes * rect.height);
+                size_t n = ZSTD_decompress(buffer.data(), buffer.size(), tile.data.data(), tile.data.size());
+                if (ZSTD_isError(n) || n != buffer.size()) {
+                    throw std::runtime_error(std::string("Corrupt history tile: ") +
+                                             (ZSTD_isError(n) ? ZSTD_getErrorName(n) : "wrong size"));
+                }
+                src = buffer.data();
+            }
+#endif
+            for (int y = 0; y < rect.height; y++) {
+                std::memcpy(out.ptr(rect.y + y) + rect.x * out.elemSize(), src + y * rowBytes, rowBytes);
+            }
+        }
+        return out;
+    }
+
+    // The cap is enforced after each frame, by evicting the oldest frames
+    // (the new one too if it alone exceeds it)
+    void store(const PendingFrame& pending) {
+        SM_TIMED_SCOPE("history.push");
+        const cv::Mat& frame = pending.frame;
+        Frame entry{pending.time, frame.size(), frame.type(), {}};
+        int ts = config.tileSize;
+        size_t elem = frame.elemSize();
+        std::vector<uint8_t> pixels;
+
+        std::lock_guard<std::mutex> lock(mutex);
+        for (int ty = 0; ty < frame.rows; ty += ts) {
+            for (int tx = 0; tx < frame.cols; tx += ts) {
+                cv::Rect rect(tx, ty, std::min(ts, frame.cols - tx), std::min(ts, frame.rows - ty));
+                size_t rowBytes = rect.width * elem;
+                uint64_t key = ((uint64_t)rect.width << 48) ^ ((uint64_t)rect.height << 32) ^ elem;
+                for (int y = rect.y; y < rect.y + rect.height; y++) {
+                    key = hashBytes(frame.ptr(y) + rect.x * elem, rowBytes, key);
+                }
+                entry.tiles.push_back(key);
+
+                Tile& tile = tiles[key];
+                if (tile.refs++ > 0) {
+                    tilesShared++;
+                    continue;
+                }
+                pixels.clear();
+                for (int y = rect.y; y < rect.y + rect.height; y++) {
+                    const uint8_t* row = frame.ptr(y) + rect.x * elem;
+                    pixels.insert(pixels.end(), row, row + rowBytes);
+                }
+#ifdef SMART_MOUSE_HAVE_ZSTD
+                if (config.compress) {
+                    tile.data.resize(ZSTD_compressBound(pixels.size()));
+                    size_t n = ZSTD_compress(tile.data.data(), tile.data.size(), pixels.data(), pixels.size(), 1);
+                    tile.compressed = !ZSTD_isError(n) && n < pixels.size();
+                    if (tile.compressed) tile.data.resize(n);
+                }
+#endif
+                if (!tile.compressed) tile.data = pixels;
+                tile.data.shrink_to_fit();
+                bytes += tile.data.size() + kTileOverhead;
+                tilesAdded++;
+            }
+        }
+        bytes += frameBytes(entry);
+        frames.push_back(std::move(entry));
+        evict(frames.back().time);
+    }
+
+    void storeLoop() {
+        Tracer::setThreadName("history");
+        std::unique_lock<std::mutex> lock(queueMutex);
+        while (true) {
+            queued.wait(lock, [&] { return stopping || !queue.empty(); });
+            if (queue.empty()) break;
+            PendingFrame pending = std::move(queue.front());
+            queue.pop_front();
+            storing = true;
+            lock.unlock();
+            store(pending);
+            lock.lock();
+            storing = false;
+            drained.notify_all();
+        }
+    }
+
+public:
+    explicit FrameHistory(const HistoryConfig& historyConfig = HistoryConfig()) : config(historyConfig) {
+        if (config.maxBytes > 0) storer = std::thread(&FrameHistory::storeLoop, this);
+    }
+
+    ~FrameHistory() {
+        {
+            std::lock_guard<std::mutex> lock(queueMutex);
+            stopping = true;
+        }
+        queued.notify_all();
+        if (storer.joinable()) storer.join();
+    }
+
+    FrameHistory(const FrameHistory&) = delete;
+    FrameHistory& operator=(const FrameHistory&) = delete;
+
+    // Queues a captured frame (shared, not copied; captures are never
+    // written to afterwards), stamped now. Never blocks: while the storer
+    // is behind, newer frames are dropped and counted.
+    void push(const cv::Mat& frame) {
+        if (!storer.joinable() || frame.empty()) return;
+        std::lock_guard<std::mutex> lock(queueMutex);
+        if (queue.size() >= kMaxQueued) {
+            framesDropped++;
+            return;
+        }
+        queue.push_back({Clock::now(), frame});
+        queued.notify_one();
+    }
+
+    // Waits until every queued frame is stored; readers call it so they
+    // see what was pushed before them
+    void drain() {
+        std::unique_lock<std::mutex> lock(queueMutex);
+        drained.wait(lock, [&] { return queue.empty() && !storing; });
+    }
+
+    size_t size() {
+        drain();
+        std::lock_guard<std::mutex> lock(mutex);
+        return frames.size();
+    }
+
+    // index 0 is the oldest frame still held; empty Mat when out of range
+    cv::Mat frameAt(size_t index) {
+        SM_TIMED_SCOPE("history.rebuild");
+        drain();
+        std::lock_guard<std::mutex> lock(mutex);
+        return index < frames.size() ? rebuild(frames[index]) : cv::Mat();
+    }
+
+    // Latest frame captured at or before secondsAgo; empty if none is held
+    cv::Mat frameAgo(double secondsAgo) {
+        SM_TIMED_SCOPE("history.rebuild");
+        drain();
+        auto when = Clock::now() - std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(secondsAgo));
+        std::lock_guard<std::mutex> lock(mutex);
+        for (auto it = frames.rbegin(); it != frames.rend(); ++it) {
+            if (it->time <= when) return rebuild(*it);
+        }
+        return cv::Mat();
+    }
+
+    // Tiles that differ between the frame secondsAgo and the latest one,
+    // straight from the tile keys without rebuilding either frame
+    std::vector<cv::Rect> changedSince(double secondsAgo) {
+        drain();
+        auto when = Clock::now() - std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(secondsAgo));
+        std::lock_guard<std::mutex> lock(mutex);
+        std::vector<cv::Rect> changed;
+        if (frames.empty()) return changed;
+        const Frame& latest = frames.back();
+        const Frame* past = nullptr;
+        for (auto it = frames.rbegin(); it != frames.rend() && !past; ++it) {
+            if (it->time <= when) past = &*it;
+        }
+        if (!past || past->size != latest.size) return {cv::Rect(cv::Point(0, 0), latest.size)};
+
+        int cols = (latest.size.width + config.tileSize - 1) / config.tileSize;
+        for (size_t i = 0; i < latest.tiles.size(); i++) {
+            if (latest.tiles[i] == past->tiles[i]) continue;
+            cv::Rect rect(int(i % cols) * config.tileSize, int(i / cols) * config.tileSize, config.tileSize, config.tileSize);
+            changed.push_back(rect & cv::Rect(cv::Point(0, 0), latest.size));
+        }
+        return changed;
+    }
+
+    void report(std::ostream& out) {
+        drain();
+        std::lock_guard<std::mutex> lock(mutex);
+        double rawMb = 0.0;
+        for (const auto& frame : frames) rawMb += frame.size.area() * CV_ELEM_SIZE(frame.type) / (1024.0 * 1024.0);
+        out << "History: " << frames.size() << " frames (" << rawMb << " MB raw) in " << tiles.size()
+            << " unique tiles, " << bytes / (1024.0 * 1024.0) << " MB of " << config.maxBytes / (1024 * 1024)
+            << " MB cap; " << tilesShared << " tiles shared, " << tilesAdded << " stored, "
+            << framesEvicted << " frames evicted, " << framesDropped << " dropped while storing\n";
+    }
+};
+
+// ============================================================================
+// DEBUG SINK
+// ============================================================================
+
+struct DebugSinkConfig {
+    std::string format = "jpg";     // jpg, png or webp
+    int quality = 80;                // jpg/webp quality; png maps it to a compression level
+    double maxPerSecond = 4.0;       // frames accepted at most; extra ones are dropped
+    size_t quotaBytes = 256u << 20;  // oldest dumps are deleted beyond this
+    size_t maxQueued = 4;            // frames waiting for the writer at most
+};
+
+// Keeps annotated frames of what each command saw. submit() only queues a
+// reference to the frame and copies of the elements; a background thread
+// draws, encodes and writes them. When the writer falls behind or the rate
+// limit is reached, frames are dropped instead of delaying the command.
+// index.tsv lists every dump: file, time_us, command, target, match box, text
+class DebugSink {
+private:
+    struct Pending {
+        uint64_t sequence;
+        int64_t timeUs;
+        cv::Mat frame;
+        std::vector<UIElement> elements;
+        bool matched;
+        UIElement match;
+        std::string command, target;
+    };
+
+    std::string dir;
+    DebugSinkConfig config;
+    std::vector<int> encodeParams;
+    std::mutex mutex;
+    std::condition_variable queued;
+    std::deque<Pending> queue;
+    bool stopping = false;
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now(), lastAccepted;
+    uint64_t nextSequence = 0;
+    std::atomic<uint64_t> written{0}, dropped{0}, throttled{0}, evicted{0};
+
+    std::deque<std::pair<std::string, size_t>> files;   // oldest first, for the quota
+    size_t diskBytes = 0;
+    std::ofstream index;
+    std::thread writer;
+
+    void write(Pending& item) {
+        cv::Mat annotated = item.frame.clone();   // the frame is shared with the caller
+        drawDetections(annotated, item.elements, item.matched ? &item.match : nullptr);
+
+        std::vector<uint8_t> encoded;
+        {
+            SM_TIMED_SCOPE("debug.encode");
+            if (!cv::imencode("." + config.format, annotated, encoded, encodeParams)) {
+                std::cerr << "Debug sink: cannot encode " << config.format << "\n";
+                return;
+            }
+        }
+
+        char name[64];
+        std::snprintf(name, sizeof(name), "%08llu-", (unsigned long long)item.sequence);
+        std::string file = name + item.command + "." + config.format;
+        {
+            SM_TIMED_SCOPE("debug.write");
+            std::ofstream out(dir + "/" + file, std::ios::binary);
+            out.write(reinterpret_cast<const char*>(encoded.data()), encoded.size());
+            if (!out) {
+                std::cerr << "Debug sink: cannot write " << dir + "/" + file << "\n";
+                return;
+            }
+        }
+        files.emplace_back(file, encoded.size());
+        diskBytes += encoded.size();
+        while (diskBytes > config.quotaBytes && files.size() > 1) {
+            std::remove((dir + "/" + files.front().first).c_str());
+            diskBytes -= files.front().second;
+            files.pop_front();
+            evicted++;
+        }
+
+        const cv::Rect& box = item.match.bounds;
+        index << file << "\t" << item.timeUs << "\t" << item.command << "\t" << tsvField(item.target) << "\t";
+        if (item.matched) {
+            index << box.x << "\t" << box.y << "\t" << box.width << "\t" << box.height << "\t" << tsvField(item.match.text);
+        } else {
+            index << "\t\t\t\t";
+        }
+        index << "\n";
+        index.flush();
+        written++;
+    }
+
+    // Whether file is one of our dumps (%08llu-<command>.<ext>); nothing
+    // else in the directory is ever counted or deleted
+    static bool isDumpName(const std::string& file) {
+        if (file.size() < 12 || file[8] != '-') return false;
+        for (int i = 0; i < 8; i++) {
+            if (!std::isdigit((unsigned char)file[i])) return false;
+        }
+        size_t dot = file.rfind('.');
+        if (dot == std::string::npos || dot < 10) return false;
+        std::string ext = file.substr(dot + 1);
+        return ext == "jpg" || ext == "png" || ext == "webp";
+    }
+
+    void writerLoop() {
+        Tracer::setThreadName("debug sink");
+        std::unique_lock<std::mutex> lock(mutex);
+        while (true) {
+            queued.wait(lock, [&] { return stopping || !queue.empty(); });
+            if (queue.empty()) break;
+            Pending item = std::move(queue.front());
+            queue.pop_front();
+            lock.unlock();
+            write(item);
+            lock.lock();
+        }
+    }
+
+public:
+    DebugSink(const std::string& directory, const DebugSinkConfig& sinkConfig = DebugSinkConfig())
+        : dir(directory), config(sinkConfig) {
+        if (config.format == "jpeg") config.format = "jpg";
+        int quality = std::max(0, std::min(100, config.quality));
+        if (config.format == "jpg") encodeParams = {cv::IMWRITE_JPEG_QUALITY, quality};
+        else if (config.format == "webp") encodeParams = {cv::IMWRITE_WEBP_QUALITY, std::max(1, quality)};
+        else if (config.format == "png") encodeParams = {cv::IMWRITE_PNG_COMPRESSION, 9 - quality * 9 / 100};
+        else throw std::runtime_error("Unknown debug format " + config.format);
+        if (!makeDirectory(dir)) throw std::runtime_error("Cannot create debug directory " + dir);
+
+        // Dumps of earlier runs count against the quota and go first
+        std::vector<std::string> existing;
+        for (const auto& entry : std::filesystem::directory_iterator(dir)) {
+            std::string file = entry.path().filename().string();
+            if (entry.is_regular_file() && isDumpName(file)) existing.push_back(file);
+        }
+        std::sort(existing.begin(), existing.end());
+        for (const auto& file : existing) {
+            size_t bytes = std::filesystem::file_size(dir + "/" + file);
+            files.emplace_back(file, bytes);
+            diskBytes += bytes;
+            nextSequence = std::max<uint64_t>(nextSequence, std::strtoull(file.c_str(), nullptr, 10) + 1);
+        }
+
+        bool fresh = !std::ifstream(dir + "/index.tsv").good();
+        index.open(dir + "/index.tsv", std::ios::app);
+        if (!index) throw std::runtime_error("Cannot write " + dir + "/index.tsv");
+        if (fresh) index << "# file\ttime_us\tcommand\ttarget\tx\ty\twidth\theight\ttext\n";
+        lastAccepted = std::chrono::steady_clock::now() - std::chrono::hours(1);
+        writer = std::thread(&DebugSink::writerLoop, this);
+    }
+
+    ~DebugSink() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        queued.notify_all();
+        writer.join();
+    }
+
+    // Never waits for the writer; returns false when the frame was dropped
+    bool submit(const cv::Mat& frame, const std::vector<UIElement>& elements, const UIElement* match,
+                const std::string& command, const std::string& target) {
+        if (frame.empty()) return false;
+        auto now = std::chrono::steady_clock::now();
+        std::lock_guard<std::mutex> lock(mutex);
+        if (config.maxPerSecond > 0 &&
+            std::chrono::duration<double>(now - lastAccepted).count() < 1.0 / config.maxPerSecond) {
+            throttled++;
+            SM_COUNT("debug_throttled", 1);
+            return false;
+        }
+        if (queue.size() >= config.maxQueued) {
+            dropped++;
+            SM_COUNT("debug_dropped", 1);
+            return false;
+        }
+        lastAccepted = now;
+        int64_t timeUs = std::chrono::duration_cast<std::chrono::microseconds>(now - start).count();
+        queue.push_back({nextSequence++, timeUs, frame, elements, match != nullptr,
+                         match ? *match : UIElement(), command, target});
+        queued.notify_one();
+        return true;
+    }
+
+    void report(std::ostream& out) const {
+        out << "Debug frames: " << written << " written, " << dropped << " dropped (writer busy), " << throttled
+            << " over the rate limit, " << evicted << " deleted for the quota\n";
+    }
+};
+
+// ============================================================================
+// MULTI-SESSION CONTROLLER
+// ============================================================================
+
+// One display driven by the session manager
+struct Session {
+    std::string displayName;
+    std::unique_ptr<ScreenBackend> screen;
+    SmartVision vision;
+    cv::Mat lastScreenshot;
+    std::vector<UIElement> lastElements;
+
+    Session(const std::string& name, std::shared_ptr<OcrPool> pool)
+        : displayName(name), screen(makeScreenBackend(name)), vision(pool) {}
+};
+
+// Drives many displays from one process. Each session owns its
+// screen backend (and so its own X connection); all of them share one OCR
+// pool and result cache, which interleaves their jobs round-robin.
+class SessionManager {
+private:
+    std::shared_ptr<OcrPool> pool;
+    std::vector<std::unique_ptr<Session>> sessions;
+    size_t rssStart, rssAfterPool, rssAfterSessions;
+
+public:
+    SessionManager(const std::vector<std::string>& displays, const OcrPoolConfig& ocr = OcrPoolConfig()) {
+        rssStart = currentRssBytes();
+        pool = std::make_shared<OcrPool>(ocr);
+        pool->waitReady();
+        rssAfterPool = currentRssBytes();
+        for (const auto& name : displays) {
+            sessions.push_back(std::make_unique<Session>(name, pool));
+        }
+        rssAfterSessions = currentRssBytes();
+    }
+
+    size_t size() const { return sessions.size(); }
+    Session& session(size_t index) { return *sessions.at(index); }
+
+    // Captures and analyzes every session concurrently, one thread per session
+    void updateAll() {
+        std::vector<std::thread> threads;
+        std::vector<std::exception_ptr> errors(sessions.size());
+        for (size_t i = 0; i < sessions.size(); i++) {
+            threads.emplace_back([this, i, &errors] {
+                Tracer::setThreadName("session " + sessions[i]->displayName);
+                try {
+                    Session& s = *sessions[i];
+                    s.lastScreenshot = s.screen->captureScreen();
+                    s.lastElements = s.vision.analyzeScreen(s.lastScreenshot);
+                } catch (...) {
+                    errors[i] = std::current_exception();
+                }
+            });
+        }
+        for (auto& t : threads) t.join();
+        for (auto& error : errors) {
+            if (error) std::rethrow_exception(error);
+        }
+    }
+
+    bool clickOn(size_t index, const std::string& target, bool rightClick = false) {
+        Session& s = session(index);
+        s.lastScreenshot = s.screen->captureScreen();
+        s.lastElements = s.vision.analyzeScreen(s.lastScreenshot);
+
+        UIElement* elem = s.vision.findBestMatch(s.lastElements, target);
+        if (!elem) return false;
+        s.screen->click(elem->center().x, elem->center().y, rightClick);
+        return true;
+    }
+
+    // Runs full analysis rounds over all sessions and reports throughput and
+    // memory per session
+    void benchmark(int rounds, std::ostream& out) {
+        auto start = std::chrono::steady_clock::now();
+        for (int r = 0; r < rounds; r++) updateAll();
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        size_t rssEnd = currentRssBytes();
+
+        const double mb = 1024.0 * 1024.0;
+        double analysesPerSecond = sessions.size() * rounds / seconds;
+        double perSessionMb = sessions.empty() ? 0.0 :
+            ((double)rssEnd - (double)rssAfterPool) / mb / sessions.size();
+
+        out << "Sessions: " << sessions.size() << ", OCR workers: " << pool->workerCount() << "\n";
+        out << "Analyzed " << sessions.size() * rounds << " screens in " << seconds << " s ("
+            << analysesPerSecond << " screens/s)\n";
+        out << "OCR jobs: " << pool->jobs() << ", cache hits: " << pool->hits() << "\n";
+        out << "RSS: base " << rssStart / mb << " MB, OCR pool "
+            << ((double)rssAfterPool - (double)rssStart) / mb << " MB, sessions opened "
+            << ((double)rssAfterSessions - (double)rssAfterPool) / mb
+            << " MB, per session after analysis " << perSessionMb << " MB\n";
+        out << "Capacity at one refresh per second: " << (long)analysesPerSecond << " sessions/host\n";
+    }
+};
+
+// ============================================================================
+// DETECTION OVERLAY
+// ============================================================================
+
+// Draws element boxes live on top of the desktop without taking input or
+// focus: an override-redirect window whose bounding shape is just the box
+// outlines and label tags, and whose input shape is empty (click-through).
+// A thread with its own display connection redraws whenever the element set
+// changes, at most at the refresh rate. The overlay shows up in captures, so
+// capture() paints the regions it covers with clean pixels kept by that
+// thread: saved just before a new shape goes up, and refreshed every
+// kCleanIntervalMs by dropping the shape for a moment to read them again.
+class DetectionOverlay {
+private:
+    using Clock = std::chrono::steady_clock;
+    static constexpr int kStroke = 2;
+    static constexpr int kTagHeight = 14;
+    static constexpr int kCleanIntervalMs = 1000;   // max age of the pixels shown in place of the overlay
+    static constexpr int kSettleMs = 20;            // for windows beneath to repaint once it is hidden
+
+    std::mutex mutex;
+    std::condition_variable changed;
+    std::vector<UIElement> pending;
+    bool dirty = false, stopping = false;
+    std::vector<cv::Rect> covered, previous;   // shape now, and before an update until the server has it
+    cv::Size screenSize;
+    cv::Mat lastClean;   // screen-sized BGR; what lies beneath every covered pixel
+    std::thread thread;
+
+#ifndef _WIN32
+    Display* display = nullptr;
+    Window window = 0;
+    GC gc = nullptr;
+    XFontStruct* font = nullptr;
+    std::unique_ptr<PixelConverter> converter;
+
+    std::vector<XRectangle> shapeOf(const std::vector<UIElement>& elements, std::vector<cv::Rect>& rects) {
+        std::vector<XRectangle> shape;
+        auto add = [&](int x, int y, int w, int h) {
+            if (w <= 0 || h <= 0) return;
+            rects.emplace_back(x, y, w, h);
+            shape.push_back({(short)x, (short)y, (unsigned short)w, (unsigned short)h});
+        };
+        for (const auto& elem : elements) {
+            const cv::Rect& b = elem.bounds;
+            add(b.x, b.y, b.width, kStroke);
+            add(b.x, b.y + b.height - kStroke, b.width, kStroke);
+            add(b.x, b.y, kStroke, b.height);
+            add(b.x + b.width - kStroke, b.y, kStroke, b.height);
+            if (font && !elem.text.empty()) {
+                int w = XTextWidth(font, elem.text.c_str(), (int)elem.text.size()) + 4;
+                add(b.x, std::max(0, b.y - kTagHeight), w, kTagHeight);
+            }
+        }
+        return shape;
+    }
+
+    void setShape(std::vector<XRectangle>& shape) {
+        XShapeCombineRectangles(display, window, ShapeBounding, 0, 0, shape.data(), (int)shape.size(), ShapeSet,
+                                Unsorted);
+    }
+
+    void drawLabels(const std::vector<UIElement>& elements) {
+        XClearWindow(display, window);
+        if (!font) return;
+        for (const auto& elem : elements) {
+            if (elem.text.empty()) continue;
+            int top = std::max(0, elem.bounds.y - kTagHeight);
+            XDrawString(display, window, gc, elem.bounds.x + 2, top + kTagHeight - 3, elem.text.c_str(),
+                        (int)elem.text.size());
+        }
+    }
+
+    // Copies what the screen shows in rects now into lastClean, except
+    // where the overlay itself is (skip), in one read of their bounding box
+    void saveClean(const std::vector<cv::Rect>& rects, const std::vector<cv::Rect>& skip) {
+        SM_TIMED_SCOPE("overlay.save_clean");
+        cv::Rect screenRect(cv::Point(0, 0), screenSize), area;
+        for (const auto& r : rects) area |= r & screenRect;
+        if (area.empty()) return;
+        XImage* img = XGetImage(display, DefaultRootWindow(display), area.x, area.y, area.width, area.height,
+                                AllPlanes, ZPixmap);
+        if (!img) return;
+        cv::Mat pixels;
+        try {
+            PixelFormatDesc format{img->bits_per_pixel, img->byte_order == MSBFirst, (uint32_t)img->red_mask,
+                                   (uint32_t)img->green_mask, (uint32_t)img->blue_mask};
+            if (!converter || !converter->matches(format)) converter.reset(new PixelConverter(format, PixelDst::Bgr));
+            converter->convert(reinterpret_cast<const uint8_t*>(img->data), img->bytes_per_line, img->width,
+                               img->height, pixels);
+        } catch (const std::exception&) {
+            pixels = cv::Mat();   // unsupported format: captures keep the overlay
+        }
+        XDestroyImage(img);
+        if (pixels.size() != area.size()) return;
+
+        std::lock_guard<std::mutex> lock(mutex);
+        for (const auto& r : rects) {
+            cv::Rect part = r & area;
+            if (part.empty()) continue;
+            cv::Mat mask(part.size(), CV_8UC1, cv::Scalar(255));
+            for (const auto& s : skip) {
+                cv::Rect hole = s & part;
+                if (!hole.empty()) mask(hole - part.tl()).setTo(cv::Scalar(0));
+            }
+            cv::Mat target = lastClean(part);
+            pixels(part - area.tl()).copyTo(target, mask);
+        }
+    }
+
+    void run() {
+        Tracer::setThreadName("overlay");
+        std::vector<UIElement> shown;
+        std::vector<XRectangle> shownShape;
+        std::vector<cv::Rect> shownRects;
+        auto frameInterval = std::chrono::milliseconds(16);
+        auto lastRefresh = Clock::now();
+        while (true) {
+            std::vector<UIElement> next;
+            bool update = false;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                changed.wait_for(lock, frameInterval, [&] { return dirty || stopping; });
+                if (stopping) break;
+                if (dirty) {
+                    next.swap(pending);
+                    dirty = false;
+                    update = true;
+                }
+            }
+
+            if (update) {
+                SM_TIMED_SCOPE("overlay.draw");
+                std::vector<cv::Rect> rects;
+                auto shape = shapeOf(next, rects);
+                // Beneath the new shape the screen is still clean, but where
+                // the old one is
+                std::vector<cv::Rect> added;
+                for (const auto& r : rects) {
+                    if (std::find(shownRects.begin(), shownRects.end(), r) == shownRects.end()) added.push_back(r);
+                }
+                saveClean(added, shownRects);
+                {
+                    // Mask old and new regions until the server has both
+                    std::lock_guard<std::mutex> lock(mutex);
+                    previous = covered;
+                    covered = rects;
+                }
+                setShape(shape);
+                shown.swap(next);
+                drawLabels(shown);
+                XSync(display, False);
+                {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    previous.clear();
+                }
+                shownShape.swap(shape);
+                shownRects.swap(rects);
+            }
+
+            // What changes beneath comes through at most kCleanIntervalMs late
+            if (!shownRects.empty() && Clock::now() - lastRefresh >= std::chrono::milliseconds(kCleanIntervalMs)) {
+                SM_TIMED_SCOPE("overlay.refresh_clean");
+                std::vector<XRectangle> none;
+                setShape(none);
+                XSync(display, False);
+                std::this_thread::sleep_for(std::chrono::milliseconds(kSettleMs));
+                saveClean(shownRects, {});
+                setShape(shownShape);
+                drawLabels(shown);
+                XSync(display, False);
+                lastRefresh = Clock::now();
+            }
+
+            // Exposures after mapping or when windows move underneath
+            bool exposed = false;
+            while (XPending(display)) {
+                XEvent event;
+                XNextEvent(display, &event);
+                if (event.type == Expose) exposed = true;
+            }
+            if (exposed) {
+                drawLabels(shown);
+                XFlush(display);
+            }
+            if (update) std::this_thread::sleep_for(frameInterval);
+        }
+    }
+#endif
+
+    // Parts of area the overlay covers, or did until the server got its
+    // latest shape; call with mutex held
+    void coveredIn(const cv::Rect& area, std::vector<cv::Rect>& out) const {
+        for (const auto* list : {&covered, &previous}) {
+            for (const auto& r : *list) {
+                if (!(r & area).empty()) out.push_back(r & area);
+            }
+        }
+    }
+
+public:
+    explicit DetectionOverlay(const std::string& displayName = "") {
+#ifdef _WIN32
+        (void)displayName;
+        throw std::runtime_error("The live overlay needs X11");
+#else
+        display = XOpenDisplay(displayName.empty() ? nullptr : displayName.c_str());
+        if (!display) throw std::runtime_error("Cannot open display " + displayName);
+        int event, error;
+        if (!XShapeQueryExtension(display, &event, &error)) {
+            XCloseDisplay(display);
+            throw std::runtime_error("The live overlay needs the X Shape extension");
+        }
+
+        int screen = DefaultScreen(display);
+        Colormap colormap = DefaultColormap(display, screen);
+        XColor green{};
+        green.green = 0xFFFF;
+        if (!XAllocColor(display, colormap, &green)) green.pixel = WhitePixel(display, screen);
+
+        XSetWindowAttributes attributes{};
+        attributes.override_redirect = True;
+        attributes.background_pixel = green.pixel;
+        attributes.event_mask = ExposureMask;
+        screenSize = cv::Size(DisplayWidth(display, screen), DisplayHeight(display, screen));
+        lastClean = cv::Mat(screenSize, CV_8UC3, cv::Scalar(0, 0, 0));
+        window = XCreateWindow(display, RootWindow(display, screen), 0, 0, screenSize.width, screenSize.height, 0, CopyFromParent, InputOutput, CopyFromParent,
+                               CWOverrideRedirect | CWBackPixel | CWEventMask, &attributes);
+
+        // Nothing visible and nothing clickable until the first update
+        XShapeCombineRectangles(display, window, ShapeBounding, 0, 0, nullptr, 0, ShapeSet, Unsorted);
+        XShapeCombineRectangles(display, window, ShapeInput, 0, 0, nullptr, 0, ShapeSet, Unsorted);
+
+        gc = XCreateGC(display, window, 0, nullptr);
+        XSetForeground(display, gc, BlackPixel(display, screen));
+        font = XLoadQueryFont(display, "fixed");
+        if (font) XSetFont(display, gc, font->fid);
+        XMapRaised(display, window);
+        XSync(display, False);
+        thread = std::thread(&DetectionOverlay::run, this);
+#endif
+    }
+
+    ~DetectionOverlay() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        changed.notify_all();
+        if (thread.joinable()) thread.join();
+#ifndef _WIN32
+        if (font) XFreeFont(display, font);
+        if (gc) XFreeGC(display, gc);
+        if (window) XDestroyWindow(display, window);
+        XCloseDisplay(display);
+#endif
+    }
+
+    // Replaces the boxes on screen; returns at once
+    void show(const std::vector<UIElement>& elements) {
+        std::lock_guard<std::mutex> lock(mutex);
+        pending = elements;
+        dirty = true;
+        changed.notify_one();
+    }
+
+    // Captures the screen area rect through grab so that analysis, change
+    // detection and recordings never see the overlay: the regions it covers
+    // (before or after the grab, should the shape change meanwhile) are
+    // filled from the latest clean pixels. Never waits for the overlay.
+    cv::Mat capture(const cv::Rect& rect, const std::function<cv::Mat()>& grab) {
+        SM_TIMED_SCOPE("overlay.capture");
+        cv::Rect area = rect & cv::Rect(cv::Point(0, 0), screenSize);
+        std::vector<cv::Rect> touched;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            coveredIn(area, touched);
+        }
+        cv::Mat frame = grab();
+        std::lock_guard<std::mutex> lock(mutex);
+        coveredIn(area, touched);
+        if (touched.empty() || frame.size() != area.size() || frame.type() != lastClean.type()) return frame;
+        for (const auto& r : touched) {
+            cv::Mat target = frame(r - area.tl());
+            lastClean(r).copyTo(target);
+        }
+        return frame;
+    }
+};
+
+// ============================================================================
+// SMART MOUSE AUTOMATION ENGINE
+// ============================================================================
+
+// "OK|Close|Done" -> any of the three
+static std::vector<std::string> splitQueries(const std::string& text) {
+    std::vector<std::string> queries;
+    std::istringstream in(text);
+    for (std::string query; std::getline(in, query, '|');) {
+        if (!query.empty()) queries.push_back(query);
+    }
+    return queries;
+}
+
+struct WaitResult {
+    bool found = false;       // appeared (waitFor) or vanished (waitUntilGone) in time
+    std::string query;        // the query that matched
+    UIElement element;        // waitFor: the matching element, screen coordinates
+    double elapsedMs = 0.0;   // from the call to the capture that showed it
+};
+
+class SmartMouse {
+private:
+    std::string traceDir;       // per-command traces go here while set
+    int tracedCommands = 0;
+    // Vision first: its OCR engines start loading before the display opens
+    SmartVision vision;
+    std::string displayName;
+    std::unique_ptr<ScreenBackend> screen;
+    cv::Mat lastScreenshot;
+    std::vector<UIElement> lastElements;
+    std::unique_ptr<SessionRecorder> recorder;
+    std::unique_ptr<DetectionOverlay> overlay;
+    std::unique_ptr<DebugSink> debugSink;
+    DebugSinkConfig debugConfig;
+    FrameHistory history;
+    ChangeFilter changeFilter;      // full-screen frames only
+    bool filterChanges = true;
+
+    // A frame with the live overlay (if any) kept out
+    cv::Mat capture() {
+        if (!overlay) return screen->captureScreen();
+        auto size = screen->getScreenSize();
+        return overlay->capture(cv::Rect(0, 0, size.first, size.second), [&] { return screen->captureScreen(); });
+    }
+
+    // Pixels of one screen rectangle, likewise without the overlay
+    cv::Mat captureArea(const cv::Rect& region) {
+        if (!overlay) return screen->captureRegion(region);
+        return overlay->capture(region, [&] { return screen->captureRegion(region); });
+    }
+
+    static constexpr int kWaitMinPollMs = 33;
+    static constexpr int kWaitMaxPollMs = 250;
+    static constexpr int kScrollClicks = 3;
+
+    // The changed tiles of frame (whose top-left is origin on screen) that
+    // should refresh cached elements. The filter always runs so its report
+    // can compare; with filtering off its verdict is ignored.
+    std::vector<cv::Rect> relevantChanges(ChangeFilter& filter, const std::vector<cv::Rect>& changed,
+                                          const cv::Mat& frame, const cv::Point& origin,
+                                          const std::vector<cv::Rect>& keep = std::vector<cv::Rect>()) {
+        cv::Rect cursor = screen->cursorBounds();
+        if (!cursor.empty()) cursor -= origin;
+        auto relevant = filter.filter(changed, frame.size(), cursor, keep);
+        return filterChanges ? relevant : changed;
+    }
+
+    // Brings elements detected on prev up to date with frame, given the
+    // changed tiles between them. Each changed area is first checked for a
+    // pure scroll: the elements of the panel that moved are then translated
+    // and only the newly exposed band and the lines the shift does not
+    // explain are analyzed. Everything else is re-analyzed, grown over the
+    // elements it touches so none is cut in half. Returns the number of
+    // pixels analyzed.
+    uint64_t updateElements(std::vector<UIElement>& elements, const cv::Mat& prev, const cv::Mat& frame,
+                            const std::vector<cv::Rect>& changed) {
+        if (prev.empty() || prev.size() != frame.size()) {
+            elements = vision.analyzeScreen(frame);
+            SM_COUNT("analyzed_pixels", (uint64_t)frame.cols * frame.rows);
+            return (uint64_t)frame.cols * frame.rows;
+        }
+        cv::Rect frameRect(0, 0, frame.cols, frame.rows);
+        auto padded = [&](const cv::Rect& r) {
+            return cv::Rect(r.x - 8, r.y - 8, r.width + 16, r.height + 16) & frameRect;
+        };
+        std::vector<cv::Rect> dirty;
+        for (const cv::Rect& area : mergeRects(changed, 64 * 64)) {
+            PanelShift shift;
+            if (!estimatePanelShift(prev(area), frame(area), shift)) {
+                dirty.push_back(padded(area));
+                continue;
+            }
+            SM_COUNT("panel_shifts", 1);
+            bool vertical = shift.dy != 0;
+            // lines [from, to) of the area as a frame rectangle
+            auto lines = [&](int from, int to) {
+                return vertical ? cv::Rect(area.x, area.y + from, area.width, to - from)
+                                : cv::Rect(area.x + from, area.y, to - from, area.height);
+            };
+            cv::Rect panel = lines(shift.span.first, shift.span.last);
+            cv::Point offset(-shift.dx, -shift.dy);
+            std::vector<UIElement> kept;
+            for (auto& elem : elements) {
+                if ((elem.bounds & panel) == elem.bounds) {
+                    elem.bounds += offset;
+                    if ((elem.bounds & panel) != elem.bounds) continue;   // scrolled out
+                }
+                kept.push_back(elem);
+            }
+            elements.swap(kept);
+
+            if (shift.span.bandLast > shift.span.bandFirst) {
+                dirty.push_back(padded(lines(shift.span.bandFirst, shift.span.bandLast)));
+            }
+            const auto& odd = shift.span.unexplained;
+            for (size_t i = 0; i < odd.size();) {
+                size_t j = i + 1;
+                while (j < odd.size() && odd[j] == odd[j - 1] + 1) j++;
+                dirty.push_back(padded(lines(odd[i], odd[j - 1] + 1)));
+                i = j;
+            }
+        }
+
+        uint64_t analyzed = 0;
+        for (cv::Rect area : mergeRects(dirty, 64 * 64)) {
+            for (bool grew = true; grew;) {
+                grew = false;
+                for (const auto& elem : elements) {
+                    if ((elem.bounds & area).empty()) continue;
+                    cv::Rect grown = (area | elem.bounds) & frameRect;
+                    if (grown == area) continue;
+                    area = grown;
+                    grew = true;
+                }
+            }
+            std::vector<UIElement> kept;
+            for (auto& elem : elements) {
+                if ((elem.bounds & area).empty()) kept.push_back(elem);
+            }
+            elements.swap(kept);
+            SM_COUNT("analyzed_pixels", (uint64_t)area.area());
+            analyzed += area.area();
+            for (auto elem : vision.analyzeScreen(frame(area))) {
+                elem.bounds += area.tl();
+                elements.push_back(elem);
+            }
+        }
+        return analyzed;
+    }
+
+    // Polls the screen (or just region) until done() holds after an
+    // analysis or the timeout passes. Only the first frame is analyzed
+    // whole; later ones re-run OCR only around changed tiles (and the
+    // elements those touched), keeping lastElements current throughout.
+    // Animated tiles stay masked unless an element matching one of
+    // targets lies on them. Recorded as command (with the targets), and the
+    // last analyzed frame goes to the debug sink with the first target
+    // still matching on it, if any.
+    bool pollScreen(const cv::Rect& region, double timeoutSeconds, double& elapsedMs, const std::string& command,
+                    const std::vector<std::string>& targets, const std::function<bool()>& done) {
+        using Clock = std::chrono::steady_clock;
+        auto start = Clock::now();
+        auto deadline = start + std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(timeoutSeconds));
+        auto size = screen->getScreenSize();
+        cv::Rect bounds = region.empty() ? cv::Rect(0, 0, size.first, size.second)
+                                         : region & cv::Rect(0, 0, size.first, size.second);
+        if (bounds.empty()) throw std::runtime_error("Wait region is outside the screen");
+
+        ChangeDetector detector;
+        ChangeFilter regionFilter;      // tiles of a region do not line up with the screen's
+        ChangeFilter& filter = region.empty() ? changeFilter : regionFilter;
+        std::vector<UIElement> local;   // frame coordinates
+        cv::Mat previous;               // frame local was last brought up to date with
+        int pollMs = kWaitMinPollMs;
+        bool first = true;
+
+        std::string joined;
+        for (const auto& target : targets) joined += (joined.empty() ? "" : "|") + target;
+        if (recorder) recorder->command(command, joined);
+        auto finish = [&](double ms, bool result) {
+            elapsedMs = ms;
+            if (debugSink) {
+                UIElement* match = nullptr;
+                for (size_t t = 0; t < targets.size() && !match; t++) match = vision.findBestMatch(local, targets[t]);
+                debugSink->submit(previous, local, match, command, joined);
+            }
+            return result;
+        };
+        while (true) {
+            auto captured = Clock::now();
+            cv::Mat frame = region.empty() ? capture() : captureArea(bounds);
+            std::vector<cv::Rect> keep;
+            for (const auto& target : targets) {
+                if (UIElement* elem = vision.findBestMatch(local, target)) keep.push_back(elem->bounds);
+            }
+            auto changed = relevantChanges(filter, detector.update(frame), frame, bounds.tl(), keep);
+            if (first || !changed.empty()) {
+                SM_COUNT("wait_analyses", 1);
+                if (first) {
+                    local = vision.analyzeScreen(frame);
+                } else {
+                    updateElements(local, previous, frame, changed);
+                }
+                previous = frame;
+                first = false;
+                pollMs = kWaitMinPollMs;
+
+                lastElements = local;
+                for (auto& elem : lastElements) elem.bounds += bounds.tl();
+                if (region.empty()) {
+                    lastScreenshot = frame;
+                    history.push(frame);
+                    if (recorder) {
+                        recorder->addFrame(frame);
+                        recorder->elements(lastElements);
+                    }
+                }
+                if (done()) return finish(std::chrono::duration<double, std::milli>(captured - start).count(), true);
+            } else {
+                pollMs = std::min(pollMs * 2, kWaitMaxPollMs);
+            }
+
+            auto now = Clock::now();
+            if (now >= deadline) return finish(std::chrono::duration<double, std::milli>(now - start).count(), false);
+            SM_TIMED_SCOPE("wait.sleep");
+            std::this_thread::sleep_for(std::min<Clock::duration>(std::chrono::milliseconds(pollMs), deadline - now));
+        }
+    }
+
+public:
+    // displayName as for makeScreenBackend: an X display, or "sim[:script]"
+    explicit SmartMouse(const OcrPoolConfig& ocr = OcrPoolConfig(), const HistoryConfig& historyConfig = HistoryConfig(),
+                        const std::string& displayName = "")
+        : vision(std::make_shared<OcrPool>(ocr)), displayName(displayName), screen(makeScreenBackend(displayName)),
+          history(historyConfig) {
+        startupTimeline.mark("display opened");
+    }
+
+    void updateScreen() {
+        SM_TIMED_SCOPE("command.update_screen");
+        lastScreenshot = capture();
+        startupTimeline.mark("screen captured");
+        history.push(lastScreenshot);
+        lastElements = vision.analyzeScreen(lastScreenshot);
+        startupTimeline.mark("screen analyzed");
+        if (overlay) overlay->show(lastElements);
+        if (recorder) {
+            recorder->addFrame(lastScreenshot);
+            recorder->elements(lastElements);
+        }
+        std::cout << "Detected " << lastElements.size() << " UI elements\n";
+    }
+
+    // Records frames, commands, elements and input into dir; empty stops
+    void record(const std::string& dir) {
+        if (recorder) recorder->report(std::cout);
+        recorder.reset();
+        if (!dir.empty()) recorder.reset(new SessionRecorder(dir));
+    }
+
+    // Dumps an annotated frame for every command into dir; empty stops
+    void debugTo(const std::string& dir, const DebugSinkConfig& config = DebugSinkConfig()) {
+        if (debugSink) debugSink->report(std::cout);
+        debugSink.reset();
+        debugConfig = config;
+        if (!dir.empty()) debugSink.reset(new DebugSink(dir, config));
+    }
+
+    // Whether carets, spinners and the mouse cursor may keep cached
+    // elements valid (on by default)
+    void setChangeFilter(bool enabled) { filterChanges = enabled; }
+
+    // Live overlay of the latest analysis that follows every refresh. Where
+    // none is possible (Windows, the simulated desktop, no Shape extension)
+    // a window shows the annotated frame until a key is pressed.
+    void showDetections() {
+        if (displayName.rfind("sim", 0) != 0) {
+            try {
+                if (!overlay) overlay.reset(new DetectionOverlay(displayName));
+                overlay->show(lastElements);
+                return;
+            } catch (const std::exception& e) {
+                std::cout << "No live overlay (" << e.what() << "), showing a window instead\n";
+            }
+        }
+        cv::Mat display = lastScreenshot.clone();
+        drawDetections(display, lastElements);
+        cv::imshow("Detected Elements", display);
+        cv::waitKey(0);
+    }
+
+    void hideDetections() { overlay.reset(); }
+
+    bool overlayActive() const { return overlay != nullptr; }
+
+    bool clickOn(const std::string& target, bool rightClick = false) {
+        SM_TIMED_SCOPE("command.click");
+        updateScreen();
+        if (recorder) recorder->command(rightClick ? "right" : "click", target);
         
         UIElement* elem = vision.findBestMatch(lastElements, target);
+        if (debugSink) debugSink->submit(lastScreenshot, lastElements, elem, rightClick ? "right" : "click", target);
         if (elem) {
             std::cout << "Clicking on: " << elem->text << " at (" 
                      << elem->center().x << ", " << elem->center().y << ")\n";
-            screen.click(elem->center().x, elem->center().y, rightClick);
+            if (recorder) recorder->input(rightClick ? "right" : "click", elem->center());
+            screen->click(elem->center().x, elem->center().y, rightClick);
+            startupTimeline.mark("first click");
+            return true;
+        }
+        
+        std::cout << "Could not find element matching: " << target << "\n";
+        return false;
+    }
+
+    bool doubleClickOn(const std::string& target) {
+        SM_TIMED_SCOPE("command.double_click");
+        updateScreen();
+        if (recorder) recorder->command("double", target);
+        
+        UIElement* elem = vision.findBestMatch(lastElements, target);
+        if (debugSink) debugSink->submit(lastScreenshot, lastElements, elem, "double", target);
+        if (elem) {
+            std::cout << "Double-clicking on: " << elem->text << "\n";
+            if (recorder) recorder->input("double", elem->center());
+            screen->doubleClick(elem->center().x, elem->center().y);
             return true;
         }
-        
-        std::cout << "Could not find element matching: " << target << "\n";
-        return false;
+        return false;
+    }
+
+    void moveTo(const std::string& target) {
+        SM_TIMED_SCOPE("command.move");
+        updateScreen();
+        if (recorder) recorder->command("move", target);
+        
+        UIElement* elem = vision.findBestMatch(lastElements, target);
+        if (debugSink) debugSink->submit(lastScreenshot, lastElements, elem, "move", target);
+        if (elem) {
+            std::cout << "Moving to: " << elem->text << "\n";
+            if (recorder) recorder->input("move", elem->center());
+            screen->moveMouse(elem->center().x, elem->center().y);
+        }
+    }
+
+    // Waits until any of the queries matches an element (within region,
+    // screen coordinates, when given)
+    WaitResult waitFor(const std::vector<std::string>& queries, double timeoutSeconds,
+                       const cv::Rect& region = cv::Rect()) {
+        SM_TIMED_SCOPE("command.wait_for");
+        WaitResult result;
+        result.found = pollScreen(region, timeoutSeconds, result.elapsedMs, "wait", queries, [&] {
+            for (const auto& query : queries) {
+                if (UIElement* elem = vision.findBestMatch(lastElements, query)) {
+                    result.query = query;
+                    result.element = *elem;
+                    return true;
+                }
+            }
+            return false;
+        });
+        if (result.found) {
+            std::cout << "Found " << result.element.text << " (" << result.element.type << ") at ("
+                      << result.element.center().x << ", " << result.element.center().y << ") after "
+                      << result.elapsedMs << " ms\n";
+        } else {
+            std::cout << "Timed out after " << result.elapsedMs << " ms waiting for "
+                      << (queries.empty() ? "" : queries[0]) << (queries.size() > 1 ? " (or others)" : "") << "\n";
+        }
+        return result;
+    }
+
+    // Waits until nothing matches query any more
+    WaitResult waitUntilGone(const std::string& query, double timeoutSeconds, const cv::Rect& region = cv::Rect()) {
+        SM_TIMED_SCOPE("command.wait_gone");
+        WaitResult result;
+        result.query = query;
+        result.found = pollScreen(region, timeoutSeconds, result.elapsedMs, "gone", {query}, [&] {
+            return vision.findBestMatch(lastElements, query) == nullptr;
+        });
+        if (result.found) std::cout << query << " gone after " << result.elapsedMs << " ms\n";
+        else std::cout << "Timed out after " << result.elapsedMs << " ms, " << query << " still shown\n";
+        return result;
+    }
+
+    // Scrolls scrollRegion (screen coordinates) down until query matches.
+    // Without a region, the panel is the area the first scroll moves under
+    // the screen center, where the wheel turns. The screen is analyzed whole
+    // once; after each scroll the panel's elements are brought up to date
+    // as by updateElements, so a plain scroll only analyzes the revealed
+    // band. Stops when the content no longer moves. Every step is recorded
+    // and kept in the history, and the outcome goes to the debug sink.
+    WaitResult findWithScroll(const std::string& query, const cv::Rect& scrollRegion = cv::Rect(), int maxSteps = 50) {
+        SM_TIMED_SCOPE("command.find_scroll");
+        using Clock = std::chrono::steady_clock;
+        auto start = Clock::now();
+        auto size = screen->getScreenSize();
+        cv::Rect screenRect(0, 0, size.first, size.second);
+        cv::Rect bounds = (scrollRegion.empty() ? screenRect : scrollRegion) & screenRect;
+        if (bounds.empty()) throw std::runtime_error("Scroll region is outside the screen");
+        bool panelKnown = !scrollRegion.empty();
+        cv::Point wheel(bounds.x + bounds.width / 2, bounds.y + bounds.height / 2);
+        if (recorder) recorder->command("find", query);
+
+        WaitResult result;
+        result.query = query;
+        auto captured = Clock::now();
+        cv::Mat frame = capture();
+        std::vector<UIElement> outside;   // screen coordinates, off the panel
+        std::vector<UIElement> local = vision.analyzeScreen(frame(bounds));   // panel coordinates
+        auto hashes = rowHashes(frame(bounds));
+        uint64_t analyzedPixels = bounds.area();
+        auto publish = [&] {
+            lastScreenshot = frame;
+            lastElements = outside;
+            for (auto elem : local) {
+                elem.bounds += bounds.tl();
+                lastElements.push_back(elem);
+            }
+            history.push(frame);
+            if (recorder) {
+                recorder->addFrame(frame);
+                recorder->elements(lastElements);
+            }
+        };
+        publish();
+
+        int steps = 0;
+        UIElement* match = nullptr;
+        while (true) {
+            if ((match = vision.findBestMatch(lastElements, query))) {
+                result.found = true;
+                result.element = *match;
+                break;
+            }
+            if (steps == maxSteps) break;
+            steps++;
+
+            if (recorder) recorder->input("wheel", wheel);
+            screen->scroll(wheel.x, wheel.y, kScrollClicks);
+            cv::Mat next;
+            std::vector<uint64_t> nextHashes;
+            auto repaintDeadline = Clock::now() + std::chrono::milliseconds(500);
+            while (true) {
+                captured = Clock::now();
+                next = capture();
+                nextHashes = rowHashes(next(bounds));
+                if (nextHashes != hashes || Clock::now() >= repaintDeadline) break;
+                std::this_thread::sleep_for(std::chrono::milliseconds(kWaitMinPollMs));
+            }
+            if (nextHashes == hashes) break;   // the end of the content
+
+            if (!panelKnown) {
+                panelKnown = true;
+                cv::Rect panel = scrolledPanel(frame, next, wheel);
+                if (!panel.empty() && panel != bounds) {
+                    // bounds was the screen: local is in screen coordinates
+                    std::vector<UIElement> inside;
+                    for (auto elem : local) {
+                        if ((elem.bounds & panel) == elem.bounds) {
+                            elem.bounds -= panel.tl();
+                            inside.push_back(elem);
+                        } else if ((elem.bounds & panel).empty()) {
+                            outside.push_back(elem);
+                        }
+                    }
+                    local.swap(inside);
+                    bounds = panel;
+                    hashes = rowHashes(frame(bounds));
+                    nextHashes = rowHashes(next(bounds));
+                }
+            }
+
+            analyzedPixels += updateElements(local, frame(bounds), next(bounds),
+                                             {cv::Rect(0, 0, bounds.width, bounds.height)});
+            frame = next;
+            hashes.swap(nextHashes);
+            publish();
+        }
+
+        if (debugSink) debugSink->submit(lastScreenshot, lastElements, match, "find", query);
+        result.elapsedMs = std::chrono::duration<double, std::milli>(captured - start).count();
+        double fullAnalyses = (double)analyzedPixels / bounds.area();
+        if (result.found) std::cout << "Found " << result.element.text << " after " << steps << " scroll steps";
+        else std::cout << "Could not find " << query << " in " << steps << " scroll steps";
+        std::cout << " (" << result.elapsedMs << " ms, analyzed " << fullAnalyses << " panels' worth of pixels)\n";
+        return result;
+    }
+
+    // Runs a watch list (see loadRegionWatches) against this screen, with
+    // the live overlay kept out of every capture
+    void watchRegions(const std::string& path, double seconds) {
+        SM_TIMED_SCOPE("command.regions");
+        RegionWatcher watcher(*screen, vision.ocrPool(), [this](const cv::Rect& rect) { return captureArea(rect); });
+        addRegionWatches(watcher, loadRegionWatches(path), std::cout);
+        watcher.run(seconds);
+        watcher.report(std::cout);
+    }
+
+    // Scrolls until target shows up, then clicks it
+    bool scrollToAndClick(const std::string& target, const cv::Rect& scrollRegion = cv::Rect()) {
+        WaitResult result = findWithScroll(target, scrollRegion);
+        if (!result.found) return false;
+        if (recorder) {
+            recorder->command("click", target);
+            recorder->input("click", result.element.center());
+        }
+        screen->click(result.element.center().x, result.element.center().y);
+        return true;
+    }
+
+    // Clicks the target (when given) to focus it, then types text
+    bool typeInto(const std::string& target, const std::string& text) {
+        SM_TIMED_SCOPE("command.type");
+        if (!target.empty() && !clickOn(target)) return false;
+        if (recorder) recorder->command("type", text);
+        std::cout << "Typing " << text.size() << " characters\n";
+        screen->typeText(text);
+        return true;
+    }
+
+    // Continuous monitoring: re-analyzes the screen whenever it changes,
+    // polling at a rate the governor adapts to activity and CPU budget
+    void watch(double seconds, const GovernorConfig& config = GovernorConfig()) {
+        using Clock = std::chrono::steady_clock;
+        CaptureGovernor governor(config);
+        ChangeDetector detector;
+        std::vector<UIElement> elements;
+        cv::Mat previous;
+        auto deadline = Clock::now() + std::chrono::duration_cast<Clock::duration>(
+            std::chrono::duration<double>(seconds));
+
+        while (Clock::now() < deadline) {
+            auto tickStart = Clock::now();
+            double cpuStart = processCpuSeconds();
+
+            cv::Mat frame = capture();
+            auto changedTiles = relevantChanges(changeFilter, detector.update(frame), frame, cv::Point(0, 0));
+            bool changed = !changedTiles.empty() || previous.empty();
+            history.push(frame);
+            if (recorder) recorder->addFrame(frame);
+            if (changed) {
+                updateElements(elements, previous, frame, changedTiles);
+                previous = frame;
+                lastScreenshot = frame;
+                lastElements = elements;
+                if (overlay) overlay->show(lastElements);
+                if (recorder) recorder->elements(lastElements);
+                std::cout << "Screen changed: " << lastElements.size() << " UI elements\n";
+            }
+
+            governor.endTick(tickStart, changed, processCpuSeconds() - cpuStart);
+            auto delay = std::min<Clock::duration>(governor.nextDelay(), deadline - Clock::now());
+            if (delay > Clock::duration::zero()) {
+                SM_TIMED_SCOPE("watch.sleep");
+                std::this_thread::sleep_for(delay);
+            }
+        }
+        governor.report(std::cout);
+        changeFilter.report(std::cout);
+    }
+
+    // Interactive command mode
+    void commandMode() {
+        std::string cmd, target;
+        
+        std::cout << "\n=== Smart Mouse Control ===\n";
+        std::cout << "Commands:\n";
+        std::cout << "  click <text>       - Click on element containing text\n";
+        std::cout << "  right <text>       - Right-click on element\n";
+        std::cout << "  double <text>      - Double-click on element\n";
+        std::cout << "  move <text>        - Move mouse to element\n";
+        std::cout << "  type <text>        - Type text into the focused field\n";
+        std::cout << "  show [off]         - Live overlay of detected elements\n";
+        std::cout << "  refresh            - Refresh screen analysis\n";
+        std::cout << "  watch <seconds>    - Re-analyze on screen changes\n";
+        std::cout << "  wait <sec> <a|b>   - Wait until any of the texts appears\n";
+        std::cout << "  gone <sec> <text>  - Wait until the text disappears\n";
+        std::cout << "  find <text>        - Scroll the panel at the screen center to the text, click it\n";
+        std::cout << "  regions <tsv> <s>  - Run a region watch list (tsv as for the regions mode)\n";
+        std::cout << "  metrics [file]     - Dump stage timings (JSON, or Prometheus unless *.json)\n";
+        std::cout << "  trace <dir>|off    - Write a Chrome trace of every command into dir\n";
+        std::cout << "  record <dir>|off   - Record frames, elements and clicks for replay\n";
+        std::cout << "  debug <dir>|off    - Save an annotated frame for every command\n";
+        std::cout << "  history [sec file] - History stats, or save the frame from sec ago\n";
+        std::cout << "  quit               - Exit\n\n";
+        
+        while (true) {
+            std::cout << "> ";
+            if (!(std::cin >> cmd)) break;
+            
+            if (cmd == "quit") break;
+            
+            bool traced = !traceDir.empty() && cmd != "trace";
+            if (traced) Tracer::start();
+            
+            if (cmd == "show") {
+                std::getline(std::cin, target);
+                if (target.find("off") != std::string::npos) {
+                    hideDetections();
+                } else {
+                    updateScreen();
+                    showDetections();
+                }
+            }
+            else if (cmd == "refresh") {
+                updateScreen();
+            }
+            else if (cmd == "metrics") {
+                std::getline(std::cin, target);
+                target.erase(0, target.find_first_not_of(" \t"));
+                if (target.empty()) Metrics::writeJson(std::cout);
+                else if (!Metrics::dump(target)) std::cout << "Cannot write " << target << "\n";
+            }
+            else if (cmd == "watch") {
+                double seconds = 60;
+                std::cin >> seconds;
+                watch(seconds);
+            }
+            else if (cmd == "wait" || cmd == "gone") {
+                double seconds = 10;
+                std::cin >> seconds;
+                std::getline(std::cin >> std::ws, target);
+                if (cmd == "wait") waitFor(splitQueries(target), seconds);
+                else waitUntilGone(target, seconds);
+            }
+            else if (cmd == "find") {
+                std::getline(std::cin >> std::ws, target);
+                scrollToAndClick(target);
+            }
+            else if (cmd == "regions") {
+                double seconds = 60;
+                std::cin >> target >> seconds;
+                try {
+                    watchRegions(target, seconds);
+                } catch (const std::exception& e) {
+                    std::cout << "Error: " << e.what() << "\n";
+                }
+            }
+            else if (cmd == "click") {
+                std::getline(std::cin >> std::ws, target);
+                clickOn(target);
+            }
+            else if (cmd == "right") {
+                std::getline(std::cin >> std::ws, target);
+                clickOn(target, true);
+            }
+            else if (cmd == "double") {
+                std::getline(std::cin >> std::ws, target);
+                doubleClickOn(target);
+            }
+            else if (cmd == "move") {
+                std::getline(std::cin >> std::ws, target);
+                moveTo(target);
+            }
+            else if (cmd == "type") {
+                std::getline(std::cin >> std::ws, target);
+                typeInto("", target);
+            }
+            else if (cmd == "trace") {
+                std::cin >> target;
+                traceDir = (target == "off") ? "" : target;
+            }
+            else if (cmd == "history") {
+                std::getline(std::cin, target);
+                std::istringstream in(target);
+                double seconds = 0;
+                std::string file;
+                if (in >> seconds >> file) {
+                    try {
+                        cv::Mat past = history.frameAgo(seconds);
+                        auto changed = history.changedSince(seconds);
+                        if (past.empty()) std::cout << "No frame from " << seconds << " s ago\n";
+                        else if (cv::imwrite(file, past)) std::cout << "Saved to " << file << ", " << changed.size() << " tiles changed since\n";
+                        else std::cout << "Cannot write " << file << "\n";
+                    } catch (const std::exception& e) {
+                        std::cout << "Error: " << e.what() << "\n";
+                    }
+                } else {
+                    history.report(std::cout);
+                }
+            }
+            else if (cmd == "record") {
+                std::cin >> target;
+                record(target == "off" ? "" : target);
+            }
+            else if (cmd == "debug") {
+                std::cin >> target;
+                debugTo(target == "off" ? "" : target, debugConfig);
+            }
+            else {
+                std::cout << "Unknown command\n";
+            }
+            
+            if (traced) {
+                std::string path = traceDir + "/command-" + std::to_string(++tracedCommands) + "-" + cmd + ".json";
+                if (Tracer::stop(path)) std::cout << "Trace written to " << path << "\n";
+                else std::cout << "Cannot write " << path << "\n";
+            }
+        }
+    }
+};
+
+// ============================================================================
+// SYNTHETIC SCREEN GENERATOR
+// ============================================================================
+
+struct SyntheticTheme {
+    const char* name;
+    cv::Scalar desktop, window, titleBar, titleText, text, buttonFill, buttonText, border, inputFill, headerFill;
+};
+
+// Colors are BGR
+static const SyntheticTheme kSyntheticThemes[] = {
+    {"light", {180, 150, 110}, {245, 245, 245}, {225, 225, 225}, {20, 20, 20}, {30, 30, 30},
+     {215, 120, 0}, {255, 255, 255}, {170, 170, 170}, {255, 255, 255}, {230, 230, 230}},
+    {"dark", {40, 30, 25}, {45, 45, 48}, {30, 30, 30}, {220, 220, 220}, {210, 210, 210},
+     {200, 120, 60}, {255, 255, 255}, {90, 90, 90}, {30, 30, 30}, {60, 60, 60}},
+    {"warm", {120, 160, 200}, {235, 245, 250}, {200, 220, 240}, {40, 40, 80}, {40, 40, 60},
+     {60, 140, 220}, {255, 255, 255}, {150, 170, 190}, {250, 252, 255}, {215, 230, 245}},
+    {"high-contrast", {0, 0, 0}, {0, 0, 0}, {0, 0, 0}, {255, 255, 255}, {255, 255, 255},
+     {0, 255, 255}, {0, 0, 0}, {255, 255, 255}, {0, 0, 0}, {60, 60, 60}},
+};
+
+struct SyntheticScreen {
+    cv::Mat image;
+    std::vector<UIElement> truth;   // every drawn element with its exact box and text
+    std::string theme;
+    double dpiScale;
+};
+
+// Renders deterministic UI-like screens (menu bar, windows holding forms,
+// button rows, tables and paragraphs) and records ground truth for each
+// element. Windows are tiled, so any resolution just gets more of them.
+class ScreenSynthesizer {
+private:
+    std::mt19937 rng;
+    const SyntheticTheme* theme = nullptr;
+    double scale = 1.0;
+    double textScale = 0.5;
+    int font = cv::FONT_HERSHEY_SIMPLEX;
+    SyntheticScreen* screen = nullptr;
+
+    // Straight from the mt19937 output, whose sequence the standard fixes;
+    // the distributions are implementation-defined and would make the
+    // corpus differ between standard libraries
+    int uniform(int lo, int hi) {
+        uint64_t range = (uint64_t)std::max(lo, hi) - lo + 1;
+        return lo + (int)(((uint64_t)rng() * range) >> 32);
+    }
+
+    std::string word() {
+        static const char* words[] = {
+            "File", "Edit", "View", "Help", "Save", "Open", "Close", "Cancel", "Submit", "Search", "Settings",
+            "Account", "Payment", "Invoice", "Customer", "Order", "Status", "Total", "Amount", "Date", "Name",
+            "Email", "Address", "Export", "Import", "Delete", "Update", "Refresh", "Approve", "Reject",
+            "Pending", "Failed", "Complete", "Report", "Summary", "Details", "Options", "Profile", "Logout"};
+        return words[uniform(0, (int)(sizeof(words) / sizeof(words[0])) - 1)];
+    }
+
+    std::string phrase(int minWords, int maxWords) {
+        std::string text = word();
+        for (int i = 1, n = uniform(minWords, maxWords); i < n; i++) text += " " + word();
+        return text;
+    }
+
+    std::string number() { return std::to_string(uniform(1, 99999)); }
+
+    int textThickness(double sizeFactor) const { return std::max(1, (int)std::round(scale * sizeFactor)); }
+
+    // text shortened word by word until it fits maxWidth, with its size as
+    // drawText renders it; empty if not even the first word fits
+    std::string fitText(std::string text, int maxWidth, double sizeFactor, cv::Size& size, int& baseline) {
+        double fontScale = textScale * sizeFactor;
+        size = cv::getTextSize(text, font, fontScale, textThickness(sizeFactor), &baseline);
+        while (size.width > maxWidth && text.find(' ') != std::string::npos) {
+            text.erase(text.rfind(' '));
+            size = cv::getTextSize(text, font, fontScale, textThickness(sizeFactor), &baseline);
+        }
+        return size.width > maxWidth ? std::string() : text;
+    }
+
+    // Draws text with its baseline at origin, shortened to fit maxWidth, and
+    // records its box; returns the box (empty if nothing fit)
+    cv::Rect drawText(std::string text, cv::Point origin, int maxWidth, const cv::Scalar& color,
+                      const std::string& type, bool record = true, double sizeFactor = 1.0) {
+        int baseline = 0;
+        cv::Size size;
+        text = fitText(text, maxWidth, sizeFactor, size, baseline);
+        if (text.empty()) return cv::Rect();
+
+        cv::putText(screen->image, text, origin, font, textScale * sizeFactor, color, textThickness(sizeFactor),
+                    cv::LINE_AA);
+        cv::Rect box(origin.x, origin.y - size.height, size.width, size.height + baseline);
+        if (record) screen->truth.push_back({box, text, type, 100.0f});
+        return box;
+    }
+
+    int lineHeight(double sizeFactor = 1.0) {
+        int baseline = 0;
+        return cv::getTextSize("Ag", font, textScale * sizeFactor, 1, &baseline).height + baseline;
+    }
+
+    // Records the label as rendered (possibly shortened); draws nothing and
+    // returns false when not even its first word fits
+    bool drawButton(cv::Rect rect, const std::string& label) {
+        int baseline = 0;
+        cv::Size size;
+        std::string shown = fitText(label, rect.width - 4, 1.0, size, baseline);
+        if (shown.empty()) return false;
+        cv::rectangle(screen->image, rect, theme->buttonFill, cv::FILLED);
+        cv::rectangle(screen->image, rect, theme->border, std::max(1, (int)scale));
+        cv::Point origin(rect.x + (rect.width - size.width) / 2, rect.y + (rect.height + size.height) / 2);
+        drawText(shown, origin, rect.width - 4, theme->buttonText, "text", false);
+        screen->truth.push_back({rect, shown, "button", 100.0f});
+        return true;
+    }
+
+    int drawFormRow(cv::Rect area) {
+        int h = (int)(32 * scale);
+        if (area.height < h) return 0;
+        int labelWidth = area.width / 3;
+        drawText(word() + ":", cv::Point(area.x, area.y + (h + lineHeight()) / 2 - 2), labelWidth - 8,
+                 theme->text, "text");
+        cv::Rect input(area.x + labelWidth, area.y + 2, area.width - labelWidth, h - 4);
+        cv::rectangle(screen->image, input, theme->inputFill, cv::FILLED);
+        cv::rectangle(screen->image, input, theme->border, std::max(1, (int)scale));
+        std::string value = uniform(0, 2) ? phrase(1, 2) : number();
+        drawText(value, cv::Point(input.x + (int)(6 * scale), input.y + (input.height + lineHeight()) / 2 - 2),
+                 input.width - (int)(12 * scale), theme->text, "text", false);
+        screen->truth.push_back({input, value, "input", 100.0f});
+        return h + (int)(6 * scale);
+    }
+
+    int drawButtonRow(cv::Rect area) {
+        int h = (int)(34 * scale);
+        if (area.height < h) return 0;
+        int x = area.x;
+        for (int i = 0, n = uniform(1, 3); i < n; i++) {
+            std::string label = uniform(0, 3) ? word() : phrase(2, 2);
+            int baseline = 0;
+            int w = cv::getTextSize(label, font, textScale, textThickness(1.0), &baseline).width + (int)(32 * scale);
+            if (x + w > area.x + area.width) break;
+            if (drawButton(cv::Rect(x, area.y, w, h), label)) x += w + (int)(12 * scale);
+        }
+        return h + (int)(10 * scale);
+    }
+
+    int drawTable(cv::Rect area) {
+        int rowH = (int)(26 * scale);
+        int cols = uniform(2, 4);
+        int rows = std::min(uniform(3, 8), area.height / rowH - 1);
+        if (rows < 1) return 0;
+        int colW = area.width / cols;
+        for (int r = 0; r <= rows; r++) {
+            cv::Rect row(area.x, area.y + r * rowH, colW * cols, rowH);
+            if (r == 0) cv::rectangle(screen->image, row, theme->headerFill, cv::FILLED);
+            cv::rectangle(screen->image, row, theme->border, 1);
+            for (int c = 0; c < cols; c++) {
+                if (c > 0) {
+                    cv::line(screen->image, cv::Point(row.x + c * colW, row.y),
+                             cv::Point(row.x + c * colW, row.y + rowH), theme->border, 1);
+                }
+                std::string cell = r == 0 ? word() : (c == 0 ? phrase(1, 2) : number());
+                drawText(cell, cv::Point(row.x + c * colW + (int)(6 * scale), row.y + (rowH + lineHeight()) / 2 - 2),
+                         colW - (int)(12 * scale), theme->text, "text");
+            }
+        }
+        return (rows + 1) * rowH + (int)(10 * scale);
+    }
+
+    int drawParagraph(cv::Rect area) {
+        int step = lineHeight() + (int)(6 * scale);
+        int lines = std::min(uniform(1, 4), area.height / step);
+        for (int i = 0; i < lines; i++) {
+            drawText(phrase(2, 6), cv::Point(area.x, area.y + (i + 1) * step - (int)(4 * scale)), area.width,
+                     theme->text, "text");
+        }
+        return lines * step + (int)(8 * scale);
+    }
+
+    void drawWindow(cv::Rect rect) {
+        cv::rectangle(screen->image, rect, theme->window, cv::FILLED);
+        cv::rectangle(screen->image, rect, theme->border, std::max(1, (int)scale));
+        int titleH = (int)(28 * scale);
+        cv::rectangle(screen->image, cv::Rect(rect.x, rect.y, rect.width, titleH), theme->titleBar, cv::FILLED);
+        drawText(phrase(1, 3), cv::Point(rect.x + (int)(10 * scale), rect.y + (titleH + lineHeight()) / 2 - 2),
+                 rect.width - (int)(20 * scale), theme->titleText, "text");
+
+        int pad = (int)(14 * scale);
+        cv::Rect content(rect.x + pad, rect.y + titleH + pad, rect.width - 2 * pad, rect.height - titleH - 2 * pad);
+        int y = content.y;
+        while (y < content.y + content.height) {
+            cv::Rect remaining(content.x, y, content.width, content.y + content.height - y);
+            int used = 0;
+            switch (uniform(0, 3)) {
+                case 0: used = drawFormRow(remaining); break;
+                case 1: used = drawButtonRow(remaining); break;
+                case 2: used = drawTable(remaining); break;
+                default: used = drawParagraph(remaining); break;
+            }
+            if (used == 0) break;
+            y += used;
+        }
+    }
+
+public:
+    explicit ScreenSynthesizer(unsigned seed) : rng(seed) {}
+
+    // dpiScale <= 0 picks one of the common scale factors at random
+    SyntheticScreen generate(cv::Size size, double dpiScale = 0.0) {
+        static const double scales[] = {1.0, 1.25, 1.5, 2.0};
+        static const int fonts[] = {cv::FONT_HERSHEY_SIMPLEX, cv::FONT_HERSHEY_DUPLEX,
+                                    cv::FONT_HERSHEY_COMPLEX, cv::FONT_HERSHEY_TRIPLEX};
+        SyntheticScreen result;
+        screen = &result;
+        theme = &kSyntheticThemes[uniform(0, (int)(sizeof(kSyntheticThemes) / sizeof(kSyntheticThemes[0])) - 1)];
+        scale = dpiScale > 0.0 ? dpiScale : scales[uniform(0, 3)];
+        font = fonts[uniform(0, 3)];
+        textScale = 0.5 * scale * uniform(90, 130) / 100.0;
+        result.theme = theme->name;
+        result.dpiScale = scale;
+        result.image = cv::Mat(size, CV_8UC3, theme->desktop);
+
+        // Menu bar across the top
+        int menuH = (int)(26 * scale);
+        cv::rectangle(result.image, cv::Rect(0, 0, size.width, menuH), theme->titleBar, cv::FILLED);
+        int x = (int)(10 * scale);
+        for (const char* item : {"File", "Edit", "View", "Tools", "Window", "Help"}) {
+            cv::Rect box = drawText(item, cv::Point(x, (menuH + lineHeight()) / 2 - 2), size.width - x,
+                                    theme->titleText, "menu");
+            if (box.empty()) break;
+            x += box.width + (int)(18 * scale);
+        }
+
+        // Windows tiled over the rest, with jitter in size and position
+        int cellW = (int)(620 * scale), cellH = (int)(460 * scale);
+        for (int top = menuH; top + cellH / 2 <= size.height; top += cellH) {
+            for (int left = 0; left + cellW / 2 <= size.width; left += cellW) {
+                cv::Rect cell(left, top, std::min(cellW, size.width - left), std::min(cellH, size.height - top));
+                int margin = (int)(12 * scale);
+                cv::Rect window(cell.x + uniform(margin, 3 * margin), cell.y + uniform(margin, 3 * margin),
+                                cell.width * uniform(75, 95) / 100 - margin, cell.height * uniform(75, 95) / 100 - margin);
+                if (window.width > 160 * scale && window.height > 120 * scale) drawWindow(window);
+            }
+        }
+        screen = nullptr;
+        return result;
+    }
+};
+
+// Writes count generated screens as PNGs plus labels.tsv with one line per
+// ground-truth element: image, type, x, y, width, height, text
+static void writeSyntheticCorpus(const std::string& dir, int count, cv::Size size, unsigned seed, std::ostream& log) {
+    std::ofstream labels(dir + "/labels.tsv");
+    if (!labels) throw std::runtime_error("Cannot write " + dir + "/labels.tsv");
+    labels << "# image\ttype\tx\ty\twidth\theight\ttext\n";
+    ScreenSynthesizer synth(seed);
+    for (int i = 0; i < count; i++) {
+        SyntheticScreen screen = synth.generate(size);
+        char name[32];
+        std::snprintf(name, sizeof(name), "frame-%05d.png", i);
+        if (!cv::imwrite(dir + "/" + name, screen.image)) throw std::runtime_error("Cannot write " + dir + "/" + name);
+        for (const auto& elem : screen.truth) {
+            labels << name << "\t" << elem.type << "\t" << elem.bounds.x << "\t" << elem.bounds.y << "\t"
+                   << elem.bounds.width << "\t" << elem.bounds.height << "\t" << elem.text << "\n";
+        }
+        log << name << ": " << screen.truth.size() << " elements, theme " << screen.theme
+            << ", scale " << screen.dpiScale << "\n";
+    }
+}
+
+// ============================================================================
+// ACCURACY CORPUS
+// ============================================================================
+
+struct CorpusQuery {
+    std::string image;
+    std::string query;
+    cv::Rect expected;   // a match is correct when its center lands inside
+};
+
+// Reads expected.tsv (image, query, x, y, width, height) from dir. Without
+// one, the button rows of a synth labels.tsv become the queries, skipping
+// labels that also occur inside other text on the same image.
+static std::vector<CorpusQuery> loadCorpus(const std::string& dir) {
+    std::vector<CorpusQuery> queries;
+    std::string line;
+    std::ifstream expected(dir + "/expected.tsv");
+    if (expected) {
+        while (std::getline(expected, line)) {
+            auto f = splitTabs(line);
+            if (line.empty() || line[0] == '#' || f.size() < 6) continue;
+            queries.push_back({f[0], f[1], cv::Rect(std::stoi(f[2]), std::stoi(f[3]), std::stoi(f[4]), std::stoi(f[5]))});
+        }
+        return queries;
+    }
+
+    std::ifstream labels(dir + "/labels.tsv");
+    if (!labels) throw std::runtime_error("No expected.tsv or labels.tsv in " + dir);
+    std::map<std::string, std::vector<std::vector<std::string>>> byImage;
+    std::vector<std::string> order;
+    while (std::getline(labels, line)) {
+        auto f = splitTabs(line);
+        if (line.empty() || line[0] == '#' || f.size() < 7) continue;
+        if (!byImage.count(f[0])) order.push_back(f[0]);
+        byImage[f[0]].push_back(f);
+    }
+    auto lower = [](std::string s) {
+        std::transform(s.begin(), s.end(), s.begin(), ::tolower);
+        return s;
+    };
+    for (const auto& image : order) {
+        const auto& rows = byImage[image];
+        for (size_t i = 0; i < rows.size(); i++) {
+            if (rows[i][1] != "button") continue;
+            std::string text = lower(rows[i][6]);
+            bool ambiguous = false;
+            for (size_t j = 0; j < rows.size() && !ambiguous; j++) {
+                ambiguous = j != i && lower(rows[j][6]).find(text) != std::string::npos;
+            }
+            if (ambiguous) continue;
+            queries.push_back({image, rows[i][6], cv::Rect(std::stoi(rows[i][2]), std::stoi(rows[i][3]),
+                                                           std::stoi(rows[i][4]), std::stoi(rows[i][5]))});
+        }
+    }
+    return queries;
+}
+
+struct CorpusConfig {
+    std::string name;
+    OcrPoolConfig ocr;
+    VisionConfig vision;
+};
+
+struct CorpusResult {
+    std::string config;
+    int queries = 0, found = 0, correct = 0;
+    double p50Ms = 0.0, p99Ms = 0.0, peakRssMb = 0.0;
+
+    double precision() const { return found ? (double)correct / found : 0.0; }
+    double recall() const { return queries ? (double)correct / queries : 0.0; }
+};
+
+// --config=name:key=value,... with keys workers, isolated, lang,
+// profile=crops|words and detector=edges|none
+static CorpusConfig parseCorpusConfig(const std::string& spec) {
+    CorpusConfig config;
+    size_t colon = spec.find(':');
+    config.name = spec.substr(0, colon);
+    std::istringstream in(colon == std::string::npos ? "" : spec.substr(colon + 1));
+    std::string pair;
+    while (std::getline(in, pair, ',')) {
+        size_t eq = pair.find('=');
+        std::string key = pair.substr(0, eq), value = eq == std::string::npos ? "1" : pair.substr(eq + 1);
+        if (key == "workers") config.ocr.workers = std::atoi(value.c_str());
+        else if (key == "isolated") config.ocr.isolated = value != "0";
+        else if (key == "lang") config.ocr.language = value;
+        else if (key == "profile") config.vision.ocrButtonCrops = value != "words";
+        else if (key == "detector") config.vision.detector = value == "none" ? ButtonDetector::Disabled : ButtonDetector::Edges;
+        else throw std::runtime_error("Unknown corpus config key " + key);
+    }
+    return config;
+}
+
+static CorpusResult runCorpusConfig(const std::string& dir, const std::vector<CorpusQuery>& queries,
+                                    const CorpusConfig& config) {
+    CorpusResult result;
+    result.config = config.name;
+    resetPeakRss();
+#ifndef _WIN32
+    OcrProcess::workerPeakRss() = 0;
+#endif
+    std::vector<double> latencies;
+    {
+        OcrPoolConfig ocr = config.ocr;
+        ocr.blockingInit = true;   // keep engine start-up out of the latencies
+        SmartVision vision(std::make_shared<OcrPool>(ocr), config.vision);
+
+        for (size_t i = 0; i < queries.size();) {
+            size_t end = i;
+            while (end < queries.size() && queries[end].image == queries[i].image) end++;
+            cv::Mat image = cv::imread(dir + "/" + queries[i].image);
+            if (image.empty()) throw std::runtime_error("Cannot read image " + queries[i].image);
+
+            auto start = std::chrono::steady_clock::now();
+            auto elements = vision.analyzeScreen(image);
+            std::vector<UIElement*> matches;
+            for (size_t q = i; q < end; q++) matches.push_back(vision.findBestMatch(elements, queries[q].query));
+            latencies.push_back(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count());
+
+            for (size_t q = i; q < end; q++) {
+                result.queries++;
+                if (!matches[q - i]) continue;
+                result.found++;
+                if (queries[q].expected.contains(matches[q - i]->center())) result.correct++;
+            }
+            i = end;
+        }
+    }
+    // Isolated workers have exited with the pool; count them too
+    size_t peakBytes = peakRssBytes();
+#ifndef _WIN32
+    peakBytes += OcrProcess::workerPeakRss();
+#endif
+    result.peakRssMb = peakBytes / (1024.0 * 1024.0);
+    if (!latencies.empty()) {
+        std::sort(latencies.begin(), latencies.end());
+        result.p50Ms = latencies[latencies.size() / 2];
+        result.p99Ms = latencies[std::min(latencies.size() - 1, latencies.size() * 99 / 100)];
+    }
+    return result;
+}
+
+// corpus <dir> [--config=...]... [--out=results.tsv] [--baseline=results.tsv]
+//        [--min-precision=] [--min-recall=] [--max-p99-ms=]
+//        [--max-drop=0.02] [--max-slowdown=1.25]
+// Returns non-zero when any configuration misses an absolute threshold or
+// regresses against the baseline run.
+static int runCorpus(const std::vector<std::string>& args) {
+    std::vector<CorpusConfig> configs;
+    std::string outPath, baselinePath;
+    double minPrecision = 0.0, minRecall = 0.0, maxP99Ms = 0.0, maxDrop = 0.02, maxSlowdown = 1.25;
+    for (size_t i = 2; i < args.size(); i++) {
+        const std::string& arg = args[i];
+        if (arg.rfind("--config=", 0) == 0) configs.push_back(parseCorpusConfig(arg.substr(9)));
+        else if (arg.rfind("--out=", 0) == 0) outPath = arg.substr(6);
+        else if (arg.rfind("--baseline=", 0) == 0) baselinePath = arg.substr(11);
+        else if (arg.rfind("--min-precision=", 0) == 0) minPrecision = std::atof(arg.c_str() + 16);
+        else if (arg.rfind("--min-recall=", 0) == 0) minRecall = std::atof(arg.c_str() + 13);
+        else if (arg.rfind("--max-p99-ms=", 0) == 0) maxP99Ms = std::atof(arg.c_str() + 13);
+        else if (arg.rfind("--max-drop=", 0) == 0) maxDrop = std::atof(arg.c_str() + 11);
+        else if (arg.rfind("--max-slowdown=", 0) == 0) maxSlowdown = std::atof(arg.c_str() + 15);
+        else throw std::runtime_error("Unknown corpus option " + arg);
+    }
+    if (configs.empty()) {
+        for (const char* spec : {"default", "single-thread:workers=1", "words-profile:profile=words",
+                                 "ocr-only:detector=none"}) {
+            configs.push_back(parseCorpusConfig(spec));
+        }
+    }
+
+    auto queries = loadCorpus(args[1]);
+    if (queries.empty()) throw std::runtime_error("Corpus " + args[1] + " has no queries");
+
+    std::map<std::string, CorpusResult> baseline;
+    if (!baselinePath.empty()) {
+        std::ifstream in(baselinePath);
+        if (!in) throw std::runtime_error("Cannot read baseline " + baselinePath);
+        std::string line;
+        while (std::getline(in, line)) {
+            auto f = splitTabs(line);
+            if (line.empty() || line[0] == '#' || f.size() < 7) continue;
+            CorpusResult& r = baseline[f[0]];
+            r.config = f[0];
+            r.queries = std::stoi(f[1]);
+            r.found = std::stoi(f[2]);
+            r.correct = std::stoi(f[3]);
+            r.p50Ms = std::stod(f[4]);
+            r.p99Ms = std::stod(f[5]);
+            r.peakRssMb = std::stod(f[6]);
+        }
+    }
+
+    std::ofstream out;
+    if (!outPath.empty()) {
+        out.open(outPath);
+        out << "# config\tqueries\tfound\tcorrect\tp50_ms\tp99_ms\tpeak_rss_mb\n";
+    }
+
+    std::cout << queries.size() << " queries from " << args[1] << "\n"
+              << std::left << std::setw(20) << "config" << std::right << std::setw(10) << "precision"
+              << std::setw(8) << "recall" << std::setw(10) << "p50 ms" << std::setw(10) << "p99 ms"
+              << std::setw(10) << "peak MB" << "\n";
+    std::vector<std::string> regressions;
+    for (const auto& config : configs) {
+        CorpusResult r = runCorpusConfig(args[1], queries, config);
+        std::cout << std::left << std::setw(20) << r.config << std::right << std::fixed << std::setprecision(3)
+                  << std::setw(10) << r.precision() << std::setw(8) << r.recall() << std::setprecision(1)
+                  << std::setw(10) << r.p50Ms << std::setw(10) << r.p99Ms << std::setw(10) << r.peakRssMb
+                  << std::defaultfloat << std::setprecision(6) << std::endl;
+        if (out) {
+            out << r.config << "\t" << r.queries << "\t" << r.found << "\t" << r.correct << "\t" << r.p50Ms
+                << "\t" << r.p99Ms << "\t" << r.peakRssMb << "\n";
+        }
+
+        auto fail = [&](const std::string& what, double value, double limit) {
+            std::ostringstream msg;
+            msg << r.config << ": " << what << " " << value << " (limit " << limit << ")";
+            regressions.push_back(msg.str());
+        };
+        if (r.precision() < minPrecision) fail("precision", r.precision(), minPrecision);
+        if (r.recall() < minRecall) fail("recall", r.recall(), minRecall);
+        if (maxP99Ms > 0.0 && r.p99Ms > maxP99Ms) fail("p99 ms", r.p99Ms, maxP99Ms);
+        auto base = baseline.find(r.config);
+        if (base != baseline.end()) {
+            const CorpusResult& b = base->second;
+            if (r.precision() < b.precision() - maxDrop) fail("precision", r.precision(), b.precision() - maxDrop);
+            if (r.recall() < b.recall() - maxDrop) fail("recall", r.recall(), b.recall() - maxDrop);
+            if (r.p99Ms > b.p99Ms * maxSlowdown) fail("p99 ms", r.p99Ms, b.p99Ms * maxSlowdown);
+            if (b.peakRssMb > 0.0 && r.peakRssMb > b.peakRssMb * maxSlowdown) {
+                fail("peak MB", r.peakRssMb, b.peakRssMb * maxSlowdown);
+            }
+        }
+    }
+
+    for (const auto& regression : regressions) std::cout << "REGRESSION " << regression << "\n";
+    return regressions.empty() ? 0 : 1;
+}
+
+// ============================================================================
+// TEXT INDEX
+// ============================================================================
+
+// An index directory holds docs.tsv (one source per line; the line number is
+// the doc id), immutable segments seg-N.idx, one per flush, and
+// segments.tsv naming the live segments. A segment maps term hashes (words
+// and word bigrams) to the text lines containing them. Word boxes are kept,
+// so a phrase resolves to the exact box of its words.
+
+struct IndexWord {
+    cv::Rect box;
+    std::string text;
+};
+
+struct IndexLine {
+    uint32_t doc;
+    std::vector<IndexWord> words;
+};
+
+struct IndexSegmentHeader {
+    char magic[8];
+    uint32_t termCount, lineCount, wordCount, reserved;
+    uint64_t postingCount, textBytes;
+};
+struct IndexTermRecord { uint64_t hash; uint32_t first, count; };
+struct IndexLineRecord { uint32_t doc, firstWord, wordCount, reserved; };
+struct IndexWordRecord { int32_t x, y, width, height; uint32_t textOffset, textLength; };
+
+static const char kIndexMagic[8] = {'S', 'M', 'I', 'D', 'X', '1', 0, 0};
+
+// The live segment files of an index, oldest first: from segments.tsv, or
+// for an index written before it existed, seg-0.idx upwards
+static std::vector<std::string> indexSegments(const std::string& dir) {
+    std::vector<std::string> names;
+    std::ifstream manifest(dir + "/segments.tsv");
+    if (manifest) {
+        for (std::string line; std::getline(manifest, line);) {
+            if (!line.empty() && line[0] != '#') names.push_back(line);
+        }
+        return names;
     }
+    for (int n = 0; std::ifstream(dir + "/seg-" + std::to_string(n) + ".idx").good(); n++) {
+        names.push_back("seg-" + std::to_string(n) + ".idx");
+    }
+    return names;
+}
 
-    bool doubleClickOn(const std::string& target) {
-        updateScreen();
-        
-        UIElement* elem = vision.findBestMatch(lastElements, target);
-        if (elem) {
-            std::cout << "Double-clicking on: " << elem->text << "\n";
-            screen.doubleClick(elem->center().x, elem->center().y);
-            return true;
+// Replaces segments.tsv in one rename, so readers see either list whole
+static void writeIndexSegments(const std::string& dir, const std::vector<std::string>& names) {
+    std::string path = dir + "/segments.tsv";
+    {
+        std::ofstream out(path + ".tmp");
+        out << "# live segments, oldest first\n";
+        for (const auto& name : names) out << name << "\n";
+        if (!out) throw std::runtime_error("Cannot write " + path);
+    }
+    if (std::rename((path + ".tmp").c_str(), path.c_str()) != 0) throw std::runtime_error("Cannot write " + path);
+}
+
+// Lowercased runs of letters and digits (bytes >= 0x80 count as letters, so
+// UTF-8 words stay whole)
+static std::vector<std::string> indexTokens(const std::string& text) {
+    std::vector<std::string> tokens;
+    std::string current;
+    for (unsigned char c : text) {
+        if (std::isalnum(c) || c >= 0x80) {
+            current += (char)std::tolower(c);
+        } else if (!current.empty()) {
+            tokens.push_back(std::move(current));
+            current.clear();
         }
-        return false;
     }
+    if (!current.empty()) tokens.push_back(current);
+    return tokens;
+}
 
-    void moveTo(const std::string& target) {
-        updateScreen();
-        
-        UIElement* elem = vision.findBestMatch(lastElements, target);
-        if (elem) {
-            std::cout << "Moving to: " << elem->text << "\n";
-            screen.moveMouse(elem->center().x, elem->center().y);
+static uint64_t indexTermHash(const std::string& a, const std::string& b = "") {
+    uint64_t h = hashBytes(reinterpret_cast<const uint8_t*>(a.data()), a.size(), 1);
+    return b.empty() ? h : hashBytes(reinterpret_cast<const uint8_t*>(b.data()), b.size(), h ^ 2);
+}
+
+// OCR word elements joined into lines: rows by vertical center, split where
+// the horizontal gap exceeds twice the text height. Other elements (buttons,
+// inputs) are lines of their own.
+static std::vector<IndexLine> groupIndexLines(uint32_t doc, const std::vector<UIElement>& elements) {
+    std::vector<IndexLine> lines;
+    std::vector<const UIElement*> words;
+    for (const auto& elem : elements) {
+        if (indexTokens(elem.text).empty()) continue;
+        if (elem.type == "text") words.push_back(&elem);
+        else lines.push_back({doc, {{elem.bounds, elem.text}}});
+    }
+    std::sort(words.begin(), words.end(), [](const UIElement* a, const UIElement* b) {
+        return a->center().y < b->center().y;
+    });
+
+    for (size_t i = 0; i < words.size();) {
+        size_t end = i + 1;
+        while (end < words.size() &&
+               words[end]->center().y - words[i]->center().y <= std::max(words[i]->bounds.height, 4) / 2) {
+            end++;
         }
+        std::vector<const UIElement*> row(words.begin() + i, words.begin() + end);
+        std::sort(row.begin(), row.end(), [](const UIElement* a, const UIElement* b) {
+            return a->bounds.x < b->bounds.x;
+        });
+        for (size_t w = 0; w < row.size(); w++) {
+            const UIElement* prev = w ? row[w - 1] : nullptr;
+            bool join = prev && row[w]->bounds.x - (prev->bounds.x + prev->bounds.width) <= 2 * prev->bounds.height;
+            if (!join) lines.push_back({doc, {}});
+            lines.back().words.push_back({row[w]->bounds, row[w]->text});
+        }
+        i = end;
     }
+    return lines;
+}
 
-    // Interactive command mode
-    void commandMode() {
-        std::string cmd, target;
-        
-        std::cout << "\n=== Smart Mouse Control ===\n";
-        std::cout << "Commands:\n";
-        std::cout << "  click <text>       - Click on element containing text\n";
-        std::cout << "  right <text>       - Right-click on element\n";
-        std::cout << "  double <text>      - Double-click on element\n";
-        std::cout << "  move <text>        - Move mouse to element\n";
-        std::cout << "  show               - Show detected elements\n";
-        std::cout << "  refresh            - Refresh screen analysis\n";
-        std::cout << "  quit               - Exit\n\n";
-        
-        while (true) {
-            std::cout << "> ";
-            std::cin >> cmd;
-            
-            if (cmd == "quit") break;
-            else if (cmd == "show") {
-                updateScreen();
-                showDetections();
+// Appends frames to an index. Lines are buffered and written as a new
+// segment on flush() (and when the buffer grows large), which is then added
+// to segments.tsv; unpublished, segments are only written (compaction
+// swaps them in itself). Segment numbers are never reused. One writer per
+// index directory at a time.
+class TextIndexWriter {
+private:
+    std::string dir;
+    bool publish;
+    std::ofstream docs;
+    uint32_t nextDoc = 0;
+    std::vector<IndexLine> pending;
+    size_t pendingWords = 0;
+    std::vector<std::string> live, written;
+    int nextSegment = 0;
+
+    static constexpr size_t kFlushWords = 1 << 20;
+
+public:
+    explicit TextIndexWriter(const std::string& indexDir, bool publishSegments = true)
+        : dir(indexDir), publish(publishSegments) {
+        if (!makeDirectory(dir)) throw std::runtime_error("Cannot create index directory " + dir);
+        live = indexSegments(dir);
+        // Past every file, listed or left behind by an interrupted compaction
+        for (const auto& entry : std::filesystem::directory_iterator(dir)) {
+            std::string name = entry.path().filename().string();
+            if (name.rfind("seg-", 0) == 0) nextSegment = std::max(nextSegment, std::atoi(name.c_str() + 4) + 1);
+        }
+        std::ifstream existing(dir + "/docs.tsv");
+        std::string line;
+        while (std::getline(existing, line)) nextDoc++;
+        docs.open(dir + "/docs.tsv", std::ios::app);
+        if (!docs) throw std::runtime_error("Cannot write " + dir + "/docs.tsv");
+    }
+
+    ~TextIndexWriter() {
+        try {
+            flush();
+        } catch (const std::exception& e) {
+            std::cerr << "Index flush failed: " << e.what() << "\n";
+        }
+    }
+
+    uint32_t addFrame(const std::string& source, const std::vector<UIElement>& elements) {
+        uint32_t doc = nextDoc++;
+        docs << tsvField(source) << "\n";
+        for (auto& line : groupIndexLines(doc, elements)) addLine(std::move(line));
+        return doc;
+    }
+
+    // Keeps the line's doc id; used by compaction
+    void addLine(IndexLine line) {
+        pendingWords += line.words.size();
+        pending.push_back(std::move(line));
+        if (pendingWords >= kFlushWords) flush();
+    }
+
+    void flush() {
+        SM_TIMED_SCOPE("index.flush");
+        docs.flush();
+        if (pending.empty()) return;
+
+        std::map<uint64_t, std::vector<uint32_t>> postings;
+        std::vector<IndexLineRecord> lines;
+        std::vector<IndexWordRecord> words;
+        std::string text;
+        for (uint32_t id = 0; id < pending.size(); id++) {
+            const IndexLine& line = pending[id];
+            lines.push_back({line.doc, (uint32_t)words.size(), (uint32_t)line.words.size(), 0});
+            std::vector<std::string> tokens;
+            for (const auto& word : line.words) {
+                words.push_back({word.box.x, word.box.y, word.box.width, word.box.height,
+                                 (uint32_t)text.size(), (uint32_t)word.text.size()});
+                text += word.text;
+                for (auto& token : indexTokens(word.text)) tokens.push_back(std::move(token));
             }
-            else if (cmd == "refresh") {
-                updateScreen();
+            for (size_t t = 0; t < tokens.size(); t++) {
+                for (uint64_t term : {indexTermHash(tokens[t]),
+                                      t + 1 < tokens.size() ? indexTermHash(tokens[t], tokens[t + 1]) : 0}) {
+                    if (!term) continue;
+                    auto& list = postings[term];
+                    if (list.empty() || list.back() != id) list.push_back(id);
+                }
             }
-            else if (cmd == "click") {
-                std::getline(std::cin >> std::ws, target);
-                clickOn(target);
+        }
+
+        std::vector<IndexTermRecord> terms;
+        std::vector<uint32_t> flat;
+        for (const auto& entry : postings) {
+            terms.push_back({entry.first, (uint32_t)flat.size(), (uint32_t)entry.second.size()});
+            flat.insert(flat.end(), entry.second.begin(), entry.second.end());
+        }
+
+        IndexSegmentHeader header{};
+        std::memcpy(header.magic, kIndexMagic, sizeof(kIndexMagic));
+        header.termCount = (uint32_t)terms.size();
+        header.lineCount = (uint32_t)lines.size();
+        header.wordCount = (uint32_t)words.size();
+        header.postingCount = flat.size();
+        header.textBytes = text.size();
+
+        std::string name = "seg-" + std::to_string(nextSegment++) + ".idx";
+        std::string path = dir + "/" + name;
+        {
+            std::ofstream out(path + ".tmp", std::ios::binary);
+            out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+            out.write(reinterpret_cast<const char*>(terms.data()), terms.size() * sizeof(IndexTermRecord));
+            out.write(reinterpret_cast<const char*>(flat.data()), flat.size() * sizeof(uint32_t));
+            out.write(reinterpret_cast<const char*>(lines.data()), lines.size() * sizeof(IndexLineRecord));
+            out.write(reinterpret_cast<const char*>(words.data()), words.size() * sizeof(IndexWordRecord));
+            out.write(text.data(), text.size());
+            if (!out) throw std::runtime_error("Cannot write " + path);
+        }
+        if (std::rename((path + ".tmp").c_str(), path.c_str()) != 0) throw std::runtime_error("Cannot write " + path);
+        written.push_back(name);
+        if (publish) {
+            live.push_back(name);
+            writeIndexSegments(dir, live);
+        }
+        pending.clear();
+        pendingWords = 0;
+    }
+
+    // Segment files this writer created, oldest first
+    const std::vector<std::string>& segments() const { return written; }
+};
+
+struct IndexHit {
+    uint32_t doc;
+    cv::Rect box;       // the matched words
+    std::string line;   // the whole line they are part of
+};
+
+// Memory-maps every segment of an index for queries
+class TextIndexReader {
+private:
+    struct Segment {
+        const char* data = nullptr;
+        size_t size = 0;
+        bool mapped = false;
+        std::vector<char> buffer;   // Windows: file contents read once
+        const IndexSegmentHeader* header = nullptr;
+        const IndexTermRecord* terms = nullptr;
+        const uint32_t* postings = nullptr;
+        const IndexLineRecord* lines = nullptr;
+        const IndexWordRecord* words = nullptr;
+        const char* text = nullptr;
+
+        ~Segment() {
+#ifndef _WIN32
+            if (mapped) munmap(const_cast<char*>(data), size);
+#endif
+        }
+    };
+
+    std::vector<std::unique_ptr<Segment>> segments;
+    std::vector<std::string> docs;
+
+    static std::unique_ptr<Segment> open(const std::string& path) {
+        auto seg = std::make_unique<Segment>();
+#ifdef _WIN32
+        std::ifstream file(path, std::ios::binary);
+        seg->buffer.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+        seg->data = seg->buffer.data();
+        seg->size = seg->buffer.size();
+#else
+        int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0) throw std::runtime_error("Cannot open " + path);
+        struct stat st;
+        void* p = MAP_FAILED;
+        if (fstat(fd, &st) == 0 && st.st_size > 0) p = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+        close(fd);
+        if (p == MAP_FAILED) throw std::runtime_error("Cannot map " + path);
+        seg->data = static_cast<const char*>(p);
+        seg->size = st.st_size;
+        seg->mapped = true;
+#endif
+        const IndexSegmentHeader* h = reinterpret_cast<const IndexSegmentHeader*>(seg->data);
+        size_t expected = sizeof(IndexSegmentHeader);
+        if (seg->size >= expected) {
+            expected += h->termCount * sizeof(IndexTermRecord) + h->postingCount * sizeof(uint32_t) +
+                        h->lineCount * sizeof(IndexLineRecord) + h->wordCount * sizeof(IndexWordRecord) + h->textBytes;
+        }
+        if (seg->size < sizeof(IndexSegmentHeader) || h->postingCount > seg->size || h->textBytes > seg->size ||
+            seg->size != expected || std::memcmp(h->magic, kIndexMagic, sizeof(kIndexMagic)) != 0) {
+            throw std::runtime_error("Corrupt index segment " + path);
+        }
+        seg->header = h;
+        seg->terms = reinterpret_cast<const IndexTermRecord*>(h + 1);
+        seg->postings = reinterpret_cast<const uint32_t*>(seg->terms + h->termCount);
+        seg->lines = reinterpret_cast<const IndexLineRecord*>(seg->postings + h->postingCount);
+        seg->words = reinterpret_cast<const IndexWordRecord*>(seg->lines + h->lineCount);
+        seg->text = reinterpret_cast<const char*>(seg->words + h->wordCount);
+
+        // Every offset a query follows stays inside the file
+        for (uint32_t t = 0; t < h->termCount; t++) {
+            const IndexTermRecord& term = seg->terms[t];
+            if ((uint64_t)term.first + term.count > h->postingCount || (t && term.hash <= seg->terms[t - 1].hash)) {
+                throw std::runtime_error("Corrupt index segment " + path + ": term " + std::to_string(t));
             }
-            else if (cmd == "right") {
-                std::getline(std::cin >> std::ws, target);
-                clickOn(target, true);
+        }
+        for (uint64_t p = 0; p < h->postingCount; p++) {
+            if (seg->postings[p] >= h->lineCount) {
+                throw std::runtime_error("Corrupt index segment " + path + ": posting " + std::to_string(p));
             }
-            else if (cmd == "double") {
-                std::getline(std::cin >> std::ws, target);
-                doubleClickOn(target);
+        }
+        for (uint32_t l = 0; l < h->lineCount; l++) {
+            const IndexLineRecord& line = seg->lines[l];
+            if ((uint64_t)line.firstWord + line.wordCount > h->wordCount) {
+                throw std::runtime_error("Corrupt index segment " + path + ": line " + std::to_string(l));
             }
-            else if (cmd == "move") {
-                std::getline(std::cin >> std::ws, target);
-                moveTo(target);
+        }
+        for (uint32_t w = 0; w < h->wordCount; w++) {
+            const IndexWordRecord& word = seg->words[w];
+            if ((uint64_t)word.textOffset + word.textLength > h->textBytes) {
+                throw std::runtime_error("Corrupt index segment " + path + ": word " + std::to_string(w));
             }
-            else {
-                std::cout << "Unknown command\n";
+        }
+        return seg;
+    }
+
+    static std::pair<const uint32_t*, const uint32_t*> lookup(const Segment& seg, uint64_t term) {
+        const IndexTermRecord* end = seg.terms + seg.header->termCount;
+        const IndexTermRecord* it = std::lower_bound(seg.terms, end, term, [](const IndexTermRecord& r, uint64_t h) {
+            return r.hash < h;
+        });
+        if (it == end || it->hash != term) return {nullptr, nullptr};
+        return {seg.postings + it->first, seg.postings + it->first + it->count};
+    }
+
+    std::string wordText(const Segment& seg, const IndexWordRecord& word) const {
+        return std::string(seg.text + word.textOffset, word.textLength);
+    }
+
+    // Finds the query tokens as a contiguous run in the line and returns the
+    // union box of the words they came from
+    bool matchLine(const Segment& seg, const IndexLineRecord& line, const std::vector<std::string>& query,
+                   IndexHit& hit) const {
+        std::vector<std::string> tokens;
+        std::vector<uint32_t> owner;
+        for (uint32_t w = 0; w < line.wordCount; w++) {
+            for (auto& token : indexTokens(wordText(seg, seg.words[line.firstWord + w]))) {
+                tokens.push_back(std::move(token));
+                owner.push_back(w);
+            }
+        }
+        for (size_t start = 0; start + query.size() <= tokens.size(); start++) {
+            if (!std::equal(query.begin(), query.end(), tokens.begin() + start)) continue;
+            hit.doc = line.doc;
+            hit.box = cv::Rect();
+            hit.line.clear();
+            for (uint32_t w = 0; w < line.wordCount; w++) {
+                const IndexWordRecord& word = seg.words[line.firstWord + w];
+                if (w >= owner[start] && w <= owner[start + query.size() - 1]) {
+                    cv::Rect box(word.x, word.y, word.width, word.height);
+                    hit.box = hit.box.empty() ? box : (hit.box | box);
+                }
+                hit.line += (w ? " " : "") + wordText(seg, word);
+            }
+            return true;
+        }
+        return false;
+    }
+
+public:
+    explicit TextIndexReader(const std::string& dir) {
+        std::ifstream docFile(dir + "/docs.tsv");
+        if (!docFile) throw std::runtime_error("No index in " + dir);
+        std::string line;
+        while (std::getline(docFile, line)) docs.push_back(line);
+        for (const auto& name : indexSegments(dir)) segments.push_back(open(dir + "/" + name));
+    }
+
+    size_t segmentCount() const { return segments.size(); }
+    size_t docCount() const { return docs.size(); }
+
+    size_t lineCount() const {
+        size_t n = 0;
+        for (const auto& seg : segments) n += seg->header->lineCount;
+        return n;
+    }
+
+    const std::string& source(uint32_t doc) const {
+        static const std::string unknown = "?";
+        return doc < docs.size() ? docs[doc] : unknown;
+    }
+
+    // Lines containing the query's words in order; bigram postings narrow
+    // multi-word queries before the phrase check
+    std::vector<IndexHit> query(const std::string& text, size_t limit) const {
+        SM_TIMED_SCOPE("index.query");
+        std::vector<IndexHit> hits;
+        auto tokens = indexTokens(text);
+        if (tokens.empty() || limit == 0) return hits;
+
+        std::vector<uint64_t> terms;
+        if (tokens.size() == 1) terms.push_back(indexTermHash(tokens[0]));
+        for (size_t t = 0; t + 1 < tokens.size(); t++) terms.push_back(indexTermHash(tokens[t], tokens[t + 1]));
+
+        for (const auto& seg : segments) {
+            std::vector<std::pair<const uint32_t*, const uint32_t*>> lists;
+            for (uint64_t term : terms) lists.push_back(lookup(*seg, term));
+            if (std::any_of(lists.begin(), lists.end(), [](const auto& l) { return l.first == nullptr; })) continue;
+            std::sort(lists.begin(), lists.end(), [](const auto& a, const auto& b) {
+                return a.second - a.first < b.second - b.first;
+            });
+
+            std::vector<uint32_t> candidates(lists[0].first, lists[0].second), next;
+            for (size_t l = 1; l < lists.size() && !candidates.empty(); l++) {
+                next.clear();
+                std::set_intersection(candidates.begin(), candidates.end(), lists[l].first, lists[l].second,
+                                      std::back_inserter(next));
+                candidates.swap(next);
+            }
+            for (uint32_t id : candidates) {
+                IndexHit hit;
+                if (matchLine(*seg, seg->lines[id], tokens, hit)) hits.push_back(std::move(hit));
+                if (hits.size() >= limit) return hits;
+            }
+        }
+        return hits;
+    }
+
+    // Every stored line, in segment order (for compaction)
+    template <typename Fn>
+    void forEachLine(Fn fn) const {
+        for (const auto& seg : segments) {
+            for (uint32_t l = 0; l < seg->header->lineCount; l++) {
+                const IndexLineRecord& record = seg->lines[l];
+                IndexLine line{record.doc, {}};
+                for (uint32_t w = 0; w < record.wordCount; w++) {
+                    const IndexWordRecord& word = seg->words[record.firstWord + w];
+                    line.words.push_back({cv::Rect(word.x, word.y, word.width, word.height), wordText(*seg, word)});
+                }
+                fn(std::move(line));
+            }
+        }
+    }
+};
+
+// Element lists from a batch TSV (image, type, x, y, width, height,
+// confidence, text) or from a recording's events.tsv, one frame at a time
+static size_t indexAddFile(TextIndexWriter& writer, const std::string& path) {
+    bool recording = std::ifstream(path + "/events.tsv").good();
+    std::ifstream in(recording ? path + "/events.tsv" : path);
+    if (!in) throw std::runtime_error("Cannot read " + path);
+
+    size_t frames = 0;
+    std::string current, line;
+    std::vector<UIElement> elements;
+    auto flushFrame = [&] {
+        if (!current.empty()) writer.addFrame(current, elements);
+        frames += !current.empty();
+        elements.clear();
+    };
+    while (std::getline(in, line)) {
+        auto f = splitTabs(line);
+        if (line.empty() || line[0] == '#') continue;
+        std::string source;
+        size_t first;   // index of the type field
+        if (recording) {
+            if (f.size() < 10 || f[2] != "element") continue;
+            source = path + "#" + f[1];
+            first = 3;
+        } else {
+            if (f.size() < 8) continue;
+            source = f[0];
+            first = 1;
+        }
+        if (source != current) {
+            flushFrame();
+            current = source;
+        }
+        UIElement elem;
+        elem.type = f[first];
+        elem.bounds = cv::Rect(std::stoi(f[first + 1]), std::stoi(f[first + 2]), std::stoi(f[first + 3]), std::stoi(f[first + 4]));
+        elem.confidence = std::stof(f[first + 5]);
+        elem.text = f[first + 6];
+        elements.push_back(elem);
+    }
+    flushFrame();
+    return frames;
+}
+
+// index add <dir> <batch.tsv|recording>...
+// index query <dir> <text...> [--limit=N]
+// index compact <dir>
+static int runIndexCommand(const std::vector<std::string>& args) {
+    const std::string& action = args[1];
+    const std::string& dir = args[2];
+    if (action == "add") {
+        TextIndexWriter writer(dir);
+        for (size_t i = 3; i < args.size(); i++) {
+            std::cout << "Indexed " << indexAddFile(writer, args[i]) << " frames from " << args[i] << "\n";
+        }
+        return 0;
+    }
+    if (action == "query") {
+        size_t limit = 50;
+        std::string text;
+        for (size_t i = 3; i < args.size(); i++) {
+            if (args[i].rfind("--limit=", 0) == 0) limit = std::strtoul(args[i].c_str() + 8, nullptr, 10);
+            else text += (text.empty() ? "" : " ") + args[i];
+        }
+        auto t0 = std::chrono::steady_clock::now();
+        TextIndexReader reader(dir);
+        auto t1 = std::chrono::steady_clock::now();
+        auto hits = reader.query(text, limit);
+        auto t2 = std::chrono::steady_clock::now();
+        for (const auto& hit : hits) {
+            std::cout << reader.source(hit.doc) << "\t" << hit.box.x << "\t" << hit.box.y << "\t" << hit.box.width
+                      << "\t" << hit.box.height << "\t" << hit.line << "\n";
+        }
+        std::cerr << hits.size() << " hits over " << reader.lineCount() << " lines in " << reader.segmentCount()
+                  << " segments: open " << std::chrono::duration<double, std::milli>(t1 - t0).count()
+                  << " ms, query " << std::chrono::duration<double, std::milli>(t2 - t1).count() << " ms\n";
+        return hits.empty() ? 1 : 0;
+    }
+    if (action == "compact") {
+        // Rewrites all segments under new numbers, switches segments.tsv
+        // over to them, and only then removes the old files: a reader or an
+        // interruption sees the old index or the new one, never a mix
+        std::vector<std::string> old = indexSegments(dir), merged;
+        if (old.size() < 2) return 0;
+        {
+            TextIndexReader reader(dir);
+            TextIndexWriter writer(dir, false);
+            reader.forEachLine([&](IndexLine line) { writer.addLine(std::move(line)); });
+            writer.flush();
+            merged = writer.segments();
+        }
+        writeIndexSegments(dir, merged);
+        for (const auto& name : old) {
+            std::error_code error;
+            if (!std::filesystem::remove(dir + "/" + name, error) && error) {
+                std::cerr << "Cannot remove old segment " << name << ": " << error.message() << "\n";
+            }
+        }
+        std::cout << "Compacted " << old.size() << " segments into " << merged.size() << "\n";
+        return 0;
+    }
+    throw std::runtime_error("Unknown index command " + action);
+}
+
+// ============================================================================
+// BATCH ANALYSIS
+// ============================================================================
+
+struct BatchConfig {
+    int jobs = 0;            // files analyzed at once; 0 matches the OCR workers
+    int ioThreads = 2;       // decode threads feeding the analyzers
+    size_t prefetch = 8;     // decoded images waiting at most
+};
+
+struct BatchStats {
+    size_t images = 0, failed = 0, elements = 0;   // failed: unreadable or failed analysis
+    double seconds = 0.0;
+    std::string indexError;   // first failure to update the index, if any
+};
+
+static std::vector<std::string> listImages(const std::string& dir) {
+    static const char* extensions[] = {".png", ".jpg", ".jpeg", ".bmp", ".tif", ".tiff", ".webp"};
+    std::vector<std::string> files;
+    for (const auto& entry : std::filesystem::directory_iterator(dir)) {
+        if (!entry.is_regular_file()) continue;
+        std::string ext = entry.path().extension().string();
+        std::transform(ext.begin(), ext.end(), ext.begin(), ::tolower);
+        for (const char* known : extensions) {
+            if (ext == known) files.push_back(entry.path().string());
+        }
+    }
+    std::sort(files.begin(), files.end());
+    return files;
+}
+
+// Decodes files on ioThreads into a bounded queue and analyzes them on jobs
+// threads, each with its own SmartVision session on one shared OCR pool.
+// Element lines are streamed to out (when given) as files finish:
+// image, type, x, y, width, height, confidence, text
+// and appended to index (when given) as one document per image, flushed
+// at the end. A file that fails only counts in stats.failed.
+static BatchStats runBatch(const std::vector<std::string>& files, const OcrPoolConfig& ocr, const BatchConfig& config,
+                           std::ostream* out, TextIndexWriter* index = nullptr) {
+    struct Decoded {
+        std::string name;
+        cv::Mat image;
+    };
+
+    OcrPoolConfig poolConfig = ocr;
+    int jobs = config.jobs > 0 ? config.jobs : (ocr.workers > 0 ? ocr.workers : (int)std::thread::hardware_concurrency());
+    jobs = std::max(1, jobs);
+    if (poolConfig.workers == 0) poolConfig.workers = jobs;
+    poolConfig.blockingInit = true;   // throughput, not engine start-up
+    auto pool = std::make_shared<OcrPool>(poolConfig);
+
+    std::mutex mutex, outMutex;
+    std::condition_variable notFull, notEmpty;
+    std::deque<Decoded> ready;
+    std::atomic<size_t> nextFile{0};
+    int readersLeft = std::max(1, config.ioThreads);
+    BatchStats stats;
+
+    auto start = std::chrono::steady_clock::now();
+    std::vector<std::thread> threads;
+    for (int i = 0, n = readersLeft; i < n; i++) {
+        threads.emplace_back([&, i] {
+            Tracer::setThreadName("batch io " + std::to_string(i));
+            for (size_t index; (index = nextFile++) < files.size();) {
+                Decoded item{files[index], cv::Mat()};
+                try {
+                    SM_TIMED_SCOPE("batch.decode");
+                    item.image = cv::imread(files[index], cv::IMREAD_COLOR);
+                } catch (const std::exception& e) {
+                    std::lock_guard<std::mutex> lock(outMutex);
+                    std::cerr << "Cannot decode " << files[index] << ": " << e.what() << "\n";
+                }
+                std::unique_lock<std::mutex> lock(mutex);
+                notFull.wait(lock, [&] { return ready.size() < config.prefetch; });
+                ready.push_back(std::move(item));
+                notEmpty.notify_one();
+            }
+            std::lock_guard<std::mutex> lock(mutex);
+            readersLeft--;
+            notEmpty.notify_all();
+        });
+    }
+    for (int i = 0; i < jobs; i++) {
+        threads.emplace_back([&, i] {
+            Tracer::setThreadName("batch job " + std::to_string(i));
+            SmartVision vision(pool);
+            while (true) {
+                Decoded item;
+                {
+                    std::unique_lock<std::mutex> lock(mutex);
+                    notEmpty.wait(lock, [&] { return !ready.empty() || readersLeft == 0; });
+                    if (ready.empty()) break;
+                    item = std::move(ready.front());
+                    ready.pop_front();
+                    notFull.notify_one();
+                }
+
+                if (item.image.empty()) {
+                    std::lock_guard<std::mutex> lock(outMutex);
+                    stats.failed++;
+                    std::cerr << "Cannot read image " << item.name << "\n";
+                    continue;
+                }
+                std::vector<UIElement> elements;
+                try {
+                    elements = vision.analyzeScreen(item.image);
+                } catch (const std::exception& e) {
+                    std::lock_guard<std::mutex> lock(outMutex);
+                    stats.failed++;
+                    std::cerr << "Cannot analyze " << item.name << ": " << e.what() << "\n";
+                    continue;
+                }
+
+                std::ostringstream lines;
+                if (out) {
+                    for (const auto& elem : elements) {
+                        lines << item.name << "\t" << elem.type << "\t" << elem.bounds.x << "\t" << elem.bounds.y << "\t"
+                              << elem.bounds.width << "\t" << elem.bounds.height << "\t" << elem.confidence << "\t"
+                              << tsvField(elem.text) << "\n";
+                    }
+                }
+                std::lock_guard<std::mutex> lock(outMutex);
+                stats.images++;
+                stats.elements += elements.size();
+                if (out) *out << lines.str();
+                if (index && stats.indexError.empty()) {
+                    try {
+                        index->addFrame(item.name, elements);
+                    } catch (const std::exception& e) {
+                        stats.indexError = e.what();
+                    }
+                }
             }
+        });
+    }
+    for (auto& thread : threads) thread.join();
+    if (index && stats.indexError.empty()) {
+        try {
+            index->flush();
+        } catch (const std::exception& e) {
+            stats.indexError = e.what();
+        }
+    }
+    stats.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    return stats;
+}
+
+// batch <dir> [out.tsv] [--jobs=N] [--io-threads=N] [--index=<dir>] [--scaling]
+// --scaling analyzes (up to 64 of) the images at 1, 2, 4... jobs up to the
+// core count and reports throughput and parallel efficiency instead
+static int runBatchMode(const std::vector<std::string>& args, const OcrPoolConfig& ocr) {
+    BatchConfig config;
+    std::string outPath = args[1] + "/analysis.tsv";
+    std::string indexDir;
+    bool scaling = false;
+    for (size_t i = 2; i < args.size(); i++) {
+        const std::string& arg = args[i];
+        if (arg.rfind("--jobs=", 0) == 0) config.jobs = std::atoi(arg.c_str() + 7);
+        else if (arg.rfind("--io-threads=", 0) == 0) config.ioThreads = std::atoi(arg.c_str() + 13);
+        else if (arg.rfind("--index=", 0) == 0) indexDir = arg.substr(8);
+        else if (arg == "--scaling") scaling = true;
+        else if (arg.rfind("--", 0) == 0) throw std::runtime_error("Unknown batch option " + arg);
+        else outPath = arg;
+    }
+
+    auto files = listImages(args[1]);
+    if (files.empty()) throw std::runtime_error("No images in " + args[1]);
+
+    if (scaling) {
+        files.resize(std::min<size_t>(files.size(), 64));
+        int cores = std::max(1u, std::thread::hardware_concurrency());
+        double base = 0.0;
+        std::cout << std::setw(6) << "jobs" << std::setw(12) << "images/s" << std::setw(10) << "speedup"
+                  << std::setw(12) << "efficiency" << "\n";
+        for (int jobs = 1; jobs <= cores; jobs = jobs * 2 > cores && jobs < cores ? cores : jobs * 2) {
+            OcrPoolConfig pool = ocr;
+            pool.workers = jobs;
+            config.jobs = jobs;
+            BatchStats stats = runBatch(files, pool, config, nullptr);
+            double rate = stats.images / stats.seconds;
+            if (jobs == 1) base = rate;
+            std::cout << std::setw(6) << jobs << std::setw(12) << rate << std::setw(10) << rate / base
+                      << std::setw(12) << rate / base / jobs << std::endl;
+        }
+        return 0;
+    }
+
+    std::ofstream out(outPath);
+    if (!out) throw std::runtime_error("Cannot write " + outPath);
+    out << "# image\ttype\tx\ty\twidth\theight\tconfidence\ttext\n";
+    std::unique_ptr<TextIndexWriter> index;
+    if (!indexDir.empty()) index = std::make_unique<TextIndexWriter>(indexDir);
+    BatchStats stats = runBatch(files, ocr, config, &out, index.get());
+    std::cout << "Analyzed " << stats.images << " images (" << stats.failed << " failed), " << stats.elements
+              << " elements in " << stats.seconds << " s: " << stats.images / stats.seconds << " images/s\n"
+              << "Results in " << outPath << "\n";
+    if (!stats.indexError.empty()) std::cerr << "Index update failed for " << indexDir << ": " << stats.indexError << "\n";
+    return stats.failed == 0 && stats.indexError.empty() ? 0 : 1;
+}
+
+// ============================================================================
+// MICROBENCHMARKS (smart_mouse_bench target)
+// ============================================================================
+
+#ifdef SMART_MOUSE_BENCH
+
+#ifndef SMART_MOUSE_GIT_REV
+#define SMART_MOUSE_GIT_REV "unknown"
+#endif
+
+// Build options (LTO, -march, PGO) so results can be compared per flavor
+#ifndef SMART_MOUSE_BUILD_FLAVOR
+#define SMART_MOUSE_BUILD_FLAVOR "unknown"
+#endif
+
+// Grants the benchmarks access to SmartVision's individual detectors
+struct VisionBenchAccess {
+    static std::vector<cv::Rect> buttons(SmartVision& v, const cv::Mat& img) { return v.detectButtonRegions(img); }
+    static std::vector<cv::Rect> colors(SmartVision& v, const cv::Mat& img) {
+        return v.detectColorRegions(img, cv::Scalar(110, 0, 0));
+    }
+    static std::vector<UIElement> text(SmartVision& v, const cv::Mat& img) { return v.detectTextRegions(img); }
+};
+
+// Keeps the compiler from discarding a result a benchmark only computes
+// (pure inlined calls vanish entirely at -O3 with LTO otherwise)
+template <typename T>
+static inline void benchSink(const T& value) {
+#if defined(__GNUC__) || defined(__clang__)
+    asm volatile("" : : "r"(&value) : "memory");
+#else
+    static const void* volatile sink;
+    sink = &value;
+#endif
+}
+
+// Runs fn until it has taken minSeconds (at least minIterations times) and
+// prints one JSON line per case so runs can be diffed across commits
+class BenchRunner {
+private:
+    std::ostream& out;
+    std::string filter;
+    double minSeconds;
+
+public:
+    BenchRunner(std::ostream& output, const std::string& nameFilter, double seconds)
+        : out(output), filter(nameFilter), minSeconds(seconds) {}
+
+    template <typename Fn>
+    void run(const std::string& name, const std::string& input, Fn fn, int minIterations = 3) {
+        if (!filter.empty() && name.find(filter) == std::string::npos) return;
+        fn();   // warm-up: first-touch allocations and lazy initialization
+
+        std::vector<double> times;
+        auto start = std::chrono::steady_clock::now();
+        while ((int)times.size() < minIterations ||
+               std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() < minSeconds) {
+            auto t0 = std::chrono::steady_clock::now();
+            fn();
+            times.push_back(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t0).count());
         }
+        std::sort(times.begin(), times.end());
+        double mean = 0.0;
+        for (double t : times) mean += t;
+        mean /= times.size();
+
+        out << "{\"bench\":\"" << name << "\",\"input\":\"" << input << "\",\"rev\":\"" << SMART_MOUSE_GIT_REV
+            << "\",\"build\":\"" << SMART_MOUSE_BUILD_FLAVOR << "\",\"simd\":\"" << simdLevel()
+            << "\",\"iterations\":" << times.size() << ",\"mean_ms\":" << mean
+            << ",\"p50_ms\":" << times[times.size() / 2]
+            << ",\"p90_ms\":" << times[times.size() * 9 / 10]
+            << ",\"min_ms\":" << times.front() << ",\"max_ms\":" << times.back() << "}" << std::endl;
     }
 };
 
+// smart_mouse_bench [--filter=name] [--seconds=N] [--out=file]
+static int runBenchmarks(const std::vector<std::string>& args) {
+    std::string filter, outPath;
+    double seconds = 1.0;
+    for (const auto& arg : args) {
+        if (arg.rfind("--filter=", 0) == 0) filter = arg.substr(9);
+        else if (arg.rfind("--seconds=", 0) == 0) seconds = std::atof(arg.c_str() + 10);
+        else if (arg.rfind("--out=", 0) == 0) outPath = arg.substr(6);
+    }
+    std::ofstream file;
+    if (!outPath.empty()) file.open(outPath);
+    BenchRunner bench(outPath.empty() ? std::cout : file, filter, seconds);
+
+    // Screen capture needs a display; point DISPLAY at an Xvfb to include it
+    try {
+        ScreenController screen;
+        auto size = screen.getScreenSize();
+        bench.run("captureScreen", std::to_string(size.first) + "x" + std::to_string(size.second) + " " +
+                  screen.captureKernel(),
+                  [&] { screen.captureScreen(); });
+    } catch (const std::exception& e) {
+        std::cerr << "Skipping captureScreen: " << e.what() << "\n";
+    }
+
+    // Open a dialog, type into it and cancel: three renders per iteration
+    {
+        SimulatedScreen sim;
+        bench.run("sim.workflow", "orders", [&] {
+            sim.click(80, 130);
+            sim.captureScreen();
+            sim.click(500, 220);
+            sim.typeText("ACME");
+            sim.captureScreen();
+            sim.click(610, 340);
+            sim.captureScreen();
+        });
+    }
+
+    OcrPoolConfig ocrConfig;
+    ocrConfig.cacheEntries = 0;   // measure recognition, not the cache
+    ocrConfig.blockingInit = true;
+    auto pool = std::make_shared<OcrPool>(ocrConfig);
+    SmartVision vision(pool);
+
+    const std::pair<const char*, cv::Size> sizes[] = {
+        {"720p", cv::Size(1280, 720)}, {"1440p", cv::Size(2560, 1440)}, {"4k", cv::Size(3840, 2160)}};
+    for (const auto& entry : sizes) {
+        std::string input = entry.first;
+        cv::Mat frame = ScreenSynthesizer(42).generate(entry.second, 1.0).image;
+        cv::Mat bgra, out;
+        cv::cvtColor(frame, bgra, cv::COLOR_BGR2BGRA);
+
+        bench.run("convert.bgra_to_bgr", input, [&] { cv::cvtColor(bgra, out, cv::COLOR_BGRA2BGR); });
+        bench.run("convert.bgra_to_gray", input, [&] { cv::cvtColor(bgra, out, cv::COLOR_BGRA2GRAY); });
+        // Capture conversion kernels; the BGRA frame's row pitch doubles as a
+        // padded stride for the narrower formats
+        const std::pair<const char*, PixelFormatDesc> formats[] = {
+            {"bgrx32", {32, false, 0xFF0000, 0x00FF00, 0x0000FF}},
+            {"xrgb32", {32, true, 0xFF0000, 0x00FF00, 0x0000FF}},
+            {"bgr24", {24, false, 0xFF0000, 0x00FF00, 0x0000FF}},
+            {"rgb565", {16, false, 0xF800, 0x07E0, 0x001F}}};
+        const std::pair<const char*, PixelDst> targets[] = {
+            {"gray", PixelDst::Gray}, {"bgr", PixelDst::Bgr}, {"bgra", PixelDst::Bgra}};
+        for (const auto& format : formats) {
+            for (const auto& target : targets) {
+                PixelConverter converter(format.second, target.second);
+                bench.run(std::string("pixel.") + format.first + "_to_" + target.first, input + " " + converter.name(),
+                          [&] { converter.convert(bgra.data, bgra.step, bgra.cols, bgra.rows, out); });
+            }
+        }
+        bench.run("hashBytes", input, [&] { benchSink(hashBytes(bgra.data, bgra.total() * bgra.elemSize())); });
+        ChangeDetector detector;
+        bench.run("changeDetect", input, [&] { benchSink(detector.update(bgra)); });
+        // A small region changes per push, as with a clock or a cursor
+        FrameHistory history;
+        cv::Mat moving = frame.clone();
+        int tick = 0;
+        bench.run("history.push", input, [&] {
+            cv::Rect spot((tick * 40) % (moving.cols - 40), 100, 40, 20);
+            cv::rectangle(moving, spot, cv::Scalar(tick % 256, 0, 0), cv::FILLED);
+            tick++;
+            history.push(moving);
+            history.drain();   // stored before moving is drawn on again
+        });
+        bench.run("history.rebuild", input, [&] { benchSink(history.frameAt(0)); });
+        bench.run("detectButtonRegions", input, [&] { benchSink(VisionBenchAccess::buttons(vision, frame)); });
+        bench.run("detectColorRegions", input, [&] { benchSink(VisionBenchAccess::colors(vision, frame)); });
+        bench.run("detectTextRegions", input, [&] { benchSink(VisionBenchAccess::text(vision, frame)); }, 1);
+        bench.run("analyzeScreen", input, [&] { benchSink(vision.analyzeScreen(frame)); }, 1);
+
+        auto buttons = VisionBenchAccess::buttons(vision, frame);
+        if (!buttons.empty()) {
+            cv::Mat crop = frame(buttons.front());
+            bench.run("ocr.crop", input, [&] { pool->submit(crop, OcrMode::Text).get(); });
+        }
+    }
+
+    // Matching over synthetic element lists of increasing size
+    std::mt19937 rng(7);
+    const char* words[] = {"File", "Edit", "View", "Save", "Save As", "Cancel", "Payment", "Submit", "Settings"};
+    for (int count : {100, 1000, 10000}) {
+        std::vector<UIElement> elements(count);
+        for (int i = 0; i < count; i++) {
+            elements[i].bounds = cv::Rect(i % 1000, i / 1000 * 20, 60, 20);
+            elements[i].text = std::string(words[rng() % 9]) + " " + std::to_string(i);
+            elements[i].type = (i % 5 == 0) ? "button" : "text";
+            elements[i].confidence = 90.0f;
+        }
+        std::string input = std::to_string(count) + " elements";
+        bench.run("textSimilarity", input, [&] {
+            double total = 0.0;
+            for (const auto& elem : elements) total += vision.textSimilarity(elem.text, "Payment failed");
+            benchSink(total);
+        });
+        bench.run("findBestMatch", input, [&] { benchSink(vision.findBestMatch(elements, "Save As")); });
+    }
+    return 0;
+}
+
+#endif // SMART_MOUSE_BENCH
+
 // ============================================================================
 // MAIN
 // ============================================================================
 
 int main(int argc, char** argv) {
+#ifndef _WIN32
+    // Worker processes spawned by an isolated OCR pool
+    if (argc > 2 && std::string(argv[1]) == "--ocr-worker") {
+        return runOcrWorkerProcess(argv[2]);
+    }
+    OcrProcess::selfPath() = argv[0];
+#endif
+
+    // Separate --options from positional arguments
+    OcrPoolConfig ocrConfig;
+    HistoryConfig historyConfig;
+    bool startupReport = false;
+    bool changeFilter = true;
+    DebugSinkConfig debugConfig;
+    std::string metricsPath, tracePath, recordPath, debugPath, displayName;
+    std::vector<std::string> args;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--isolated-ocr") ocrConfig.isolated = true;
+        else if (arg == "--eager-ocr") ocrConfig.blockingInit = true;
+        else if (arg == "--startup-report") startupReport = true;
+        else if (arg == "--no-change-filter") changeFilter = false;
+        else if (arg.rfind("--metrics-out=", 0) == 0) metricsPath = arg.substr(14);
+        else if (arg.rfind("--trace=", 0) == 0) tracePath = arg.substr(8);
+        else if (arg.rfind("--record=", 0) == 0) recordPath = arg.substr(9);
+        else if (arg.rfind("--debug-dir=", 0) == 0) debugPath = arg.substr(12);
+        else if (arg.rfind("--debug-format=", 0) == 0) debugConfig.format = arg.substr(15);
+        else if (arg.rfind("--debug-quality=", 0) == 0) debugConfig.quality = std::atoi(arg.c_str() + 16);
+        else if (arg.rfind("--debug-rate=", 0) == 0) debugConfig.maxPerSecond = std::atof(arg.c_str() + 13);
+        else if (arg.rfind("--debug-quota-mb=", 0) == 0) debugConfig.quotaBytes = (size_t)std::atol(arg.c_str() + 17) << 20;
+        else if (arg == "--sim") displayName = "sim";
+        else if (arg.rfind("--sim=", 0) == 0) displayName = "sim:" + arg.substr(6);
+        else if (arg.rfind("--history-mb=", 0) == 0) historyConfig.maxBytes = (size_t)std::atol(arg.c_str() + 13) << 20;
+        else if (arg.rfind("--history-seconds=", 0) == 0) historyConfig.seconds = std::atof(arg.c_str() + 18);
+        else if (arg.rfind("--ocr-workers=", 0) == 0) ocrConfig.workers = std::atoi(arg.c_str() + 14);
+        else if (arg.rfind("--ocr-timeout=", 0) == 0) ocrConfig.timeoutMs = std::atoi(arg.c_str() + 14);
+        else args.push_back(arg);
+    }
+
+    Tracer::setThreadName("main");
+    if (!tracePath.empty()) Tracer::start();
+
+#ifdef SMART_MOUSE_BENCH
     try {
-        SmartMouse mouse;
-        
-        if (argc > 1) {
-            // Command-line mode
-            std::string action = argv[1];
-            if (action == "click" && argc > 2) {
-                mouse.clickOn(argv[2]);
-            } else if (action == "show") {
-                mouse.updateScreen();
-                mouse.showDetections();
-            }
+        return runBenchmarks(args);
+    } catch (const std::exception& e) {
+        std::cerr << "Error: " << e.what() << std::endl;
+        return 1;
+    }
+#endif
+
+    int exitCode = 0;
+    try {
+        if (args.size() > 2 && args[0] == "sessions") {
+            // sessions <rounds> <display>...
+            std::vector<std::string> displays(args.begin() + 2, args.end());
+            SessionManager manager(displays, ocrConfig);
+            manager.benchmark(std::max(1, std::atoi(args[1].c_str())), std::cout);
+        } else if (args.size() > 2 && args[0] == "ocrmem") {
+            // ocrmem <instances> <shared|file> [lang]
+            benchmarkOcrMemory(std::max(1, std::atoi(args[1].c_str())), args[2] == "shared",
+                               args.size() > 3 ? args[3] : "eng", std::cout);
+        } else if (args.size() > 2 && args[0] == "synth") {
+            // synth <outdir> <count> [WxH] [seed]
+            cv::Size size(1920, 1080);
+            if (args.size() > 3) std::sscanf(args[3].c_str(), "%dx%d", &size.width, &size.height);
+            unsigned seed = args.size() > 4 ? (unsigned)std::stoul(args[4]) : 1;
+            writeSyntheticCorpus(args[1], std::max(1, std::atoi(args[2].c_str())), size, seed, std::cout);
+        } else if (args.size() > 1 && args[0] == "batch") {
+            // batch <dir> [out.tsv] [options], see runBatchMode
+            exitCode = runBatchMode(args, ocrConfig);
+        } else if (args.size() > 2 && args[0] == "index") {
+            // index add|query|compact <indexdir> ..., see runIndexCommand
+            exitCode = runIndexCommand(args);
+        } else if (args.size() > 1 && args[0] == "regions") {
+            // regions <watches.tsv> [seconds], see loadRegionWatches
+            runRegionWatches(args[1], args.size() > 2 ? std::atof(args[2].c_str()) : 60.0, displayName, ocrConfig,
+                             std::cout);
+        } else if (args.size() > 1 && args[0] == "replay") {
+            // replay <recording-dir>
+            exitCode = replayRecording(args[1], ocrConfig, std::cout);
+        } else if (args.size() > 1 && args[0] == "corpus") {
+            // corpus <dir> [options], see runCorpus
+            exitCode = runCorpus(args);
+        } else if (args.size() > 1 && args[0] == "ocrbench") {
+            // ocrbench <image> [iterations]
+            cv::Mat image = cv::imread(args[1]);
+            if (image.empty()) throw std::runtime_error("Cannot read image " + args[1]);
+            benchmarkOcrIsolation(image, args.size() > 2 ? std::atoi(args[2].c_str()) : 20, std::cout);
         } else {
-            // Interactive mode
-            mouse.commandMode();
+            SmartMouse mouse(ocrConfig, historyConfig, displayName);
+            mouse.setChangeFilter(changeFilter);
+            if (!recordPath.empty()) mouse.record(recordPath);
+            if (!debugPath.empty()) mouse.debugTo(debugPath, debugConfig);
+            
+            if (!args.empty()) {
+                // Command-line mode
+                std::string action = args[0];
+                if (action == "click" && args.size() > 1) {
+                    mouse.clickOn(args[1]);
+                } else if ((action == "wait" || action == "gone") && args.size() > 2) {
+                    // wait <seconds> <text|text...> [x,y,w,h], gone <seconds> <text> [x,y,w,h]
+                    cv::Rect region;
+                    if (args.size() > 3) {
+                        std::sscanf(args[3].c_str(), "%d,%d,%d,%d", &region.x, &region.y, &region.width, &region.height);
+                    }
+                    double seconds = std::atof(args[1].c_str());
+                    WaitResult result = action == "wait" ? mouse.waitFor(splitQueries(args[2]), seconds, region)
+                                                         : mouse.waitUntilGone(args[2], seconds, region);
+                    exitCode = result.found ? 0 : 1;
+                } else if (action == "find" && args.size() > 1) {
+                    // find <text> [x,y,w,h]: scroll that region (default: the panel under the
+                    // screen center) until text shows, then click it
+                    cv::Rect region;
+                    if (args.size() > 2) {
+                        std::sscanf(args[2].c_str(), "%d,%d,%d,%d", &region.x, &region.y, &region.width, &region.height);
+                    }
+                    exitCode = mouse.scrollToAndClick(args[1], region) ? 0 : 1;
+                } else if (action == "type" && args.size() > 2) {
+                    // type <target> <text>
+                    mouse.typeInto(args[1], args[2]);
+                } else if (action == "show") {
+                    // show [seconds]: the live overlay follows the screen meanwhile
+                    mouse.updateScreen();
+                    mouse.showDetections();
+                    if (mouse.overlayActive()) mouse.watch(args.size() > 1 ? std::atof(args[1].c_str()) : 10.0);
+                } else if (action == "watch") {
+                    // watch [seconds] [cpu-budget-percent]
+                    GovernorConfig config;
+                    double seconds = args.size() > 1 ? std::atof(args[1].c_str()) : 60.0;
+                    if (args.size() > 2) config.cpuBudget = std::atof(args[2].c_str()) / 100.0;
+                    mouse.watch(seconds, config);
+                }
+            } else {
+                // Interactive mode
+                mouse.commandMode();
+            }
+            if (!recordPath.empty()) mouse.record("");
+            if (!debugPath.empty()) mouse.debugTo("");
+        }
+        
+        if (startupReport) startupTimeline.report(std::cout);
+        if (!metricsPath.empty() && !Metrics::dump(metricsPath)) {
+            std::cerr << "Cannot write metrics to " << metricsPath << std::endl;
+        }
+        if (!tracePath.empty() && !Tracer::stop(tracePath)) {
+            std::cerr << "Cannot write trace to " << tracePath << std::endl;
         }
         
     } catch (const std::exception& e) {
@@ -456,5 +7045,5 @@ int main(int argc, char** argv) {
         return 1;
     }
     
-    return 0;
+    return exitCode;
 }